@@ -32,6 +32,49 @@ distribution.
 #   include <cstdarg>
 #endif
 
+#if defined(__linux__)
+#   include <sys/mman.h>   // madvise
+#endif
+
+#ifdef TINYXML2_HAS_THREADS
+#   include <condition_variable>
+#   include <thread>
+#endif
+
+#ifdef TINYXML2_HAS_ZLIB
+#   include <zlib.h>
+#endif
+
+#ifdef TINYXML2_HAS_POSIX_IO
+#   include <errno.h>
+#   include <sys/uio.h>    // writev
+#   include <unistd.h>
+#endif
+
+// SSE2 escape scanning in XMLPrinter. Aligned 16 byte loads never cross a
+// page, but may read past the end of a string, which Address- and ThreadSanitizer
+// reports; sanitized builds use the scalar loop.
+#if defined(__has_feature)
+#   if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#       define TIXML_NO_SIMD
+#   endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#   define TIXML_NO_SIMD
+#endif
+#if !defined(TIXML_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#   define TIXML_SSE2
+#   include <emmintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>     // _BitScanForward
+#   endif
+#endif
+
+#if defined(__GXX_RTTI) || defined(_CPPRTTI) || defined(__cpp_rtti)
+#   define TIXML_HAS_RTTI
+#   include <typeinfo>     // XMLPrinter::ResolveOutputMode
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1400 ) && (!defined WINCE)
 // Microsoft Visual Studio, version 2005 and higher. Not WinCE.
 	/*int _snprintf_s(
@@ -133,6 +176,114 @@ static const unsigned char TIXML_UTF_LEAD_2 = 0xbfU;
 namespace tinyxml2
 {
 
+    /*
+     * Function: OutOfMemory - fail like the global operator new does
+     */
+    static void OutOfMemory()
+    {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+        throw std::bad_alloc();
+#else
+        abort();
+#endif
+    }
+
+    /*
+     * Class: DefaultAllocator - malloc, realloc and free
+     */
+    class DefaultAllocator : public XMLAllocator
+    {
+    public:
+        virtual void* Allocate( size_t size ) {
+            void* mem = malloc( size ? size : 1 );
+            if ( !mem ) {
+                OutOfMemory();
+            }
+            return mem;
+        }
+        virtual void Deallocate( void* mem, size_t ) {
+            free( mem );
+        }
+        virtual void* Reallocate( void* mem, size_t, size_t newSize ) {
+            void* newMem = realloc( mem, newSize ? newSize : 1 );
+            if ( !newMem ) {
+                OutOfMemory();
+            }
+            return newMem;
+        }
+    };
+
+    /**
+     * Function: Reallocate - allocate, copy and deallocate
+     * @param mem
+     * @param oldSize
+     * @param newSize
+     * @return
+     */
+    void* XMLAllocator::Reallocate( void* mem, size_t oldSize, size_t newSize )
+    {
+        void* newMem = Allocate( newSize );
+        memcpy( newMem, mem, oldSize < newSize ? oldSize : newSize );
+        Deallocate( mem, oldSize );
+        return newMem;
+    }
+
+    /**
+     * Function: Default - return the allocator used unless one is set
+     * @return
+     */
+    XMLAllocator* XMLAllocator::Default()
+    {
+        static DefaultAllocator allocator;
+        return &allocator;
+    }
+
+    /**
+     * Function: AllocBlock - allocate the memory of a pool block, honouring the policy
+     * @param allocator
+     * @param size
+     * @param policy
+     * @param raw - set to the memory to hand back to the allocator
+     * @param rawSize - set to the size to hand back to the allocator
+     * @return
+     */
+    void* MemPool::AllocBlock( XMLAllocator* allocator, size_t size, const XMLPoolPolicy& policy,
+                               void** raw, size_t* rawSize )
+    {
+        size_t alignment = policy.alignment;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+        const bool hugePages = policy.hugePages && size >= HUGE_PAGE_SIZE;
+        if ( hugePages && alignment < HUGE_PAGE_SIZE ) {
+            alignment = HUGE_PAGE_SIZE;
+        }
+#endif
+        if ( alignment <= 1 ) {
+            *rawSize = size;
+            *raw = allocator->Allocate( size );
+            return *raw;
+        }
+
+        // Round up to a power of two, then over-allocate so an aligned
+        // start always fits. The slack of a huge page block is never
+        // touched, so it costs address space only.
+        size_t pow2 = 1;
+        while ( pow2 < alignment ) {
+            pow2 *= 2;
+        }
+        *rawSize = size + pow2 - 1;
+        *raw = allocator->Allocate( *rawSize );
+        char* mem = static_cast<char*>( *raw );
+        mem += ( pow2 - reinterpret_cast<uintptr_t>( mem ) % pow2 ) % pow2;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if ( hugePages ) {
+            // Advisory only; a kernel without THP just ignores it.
+            madvise( mem, size, MADV_HUGEPAGE );
+        }
+#endif
+        return mem;
+    }
+
     struct Entity {
         const char* pattern;
         int length;
@@ -153,6 +304,22 @@ namespace tinyxml2
     };
 
 
+    /*
+     * An owned (NEEDS_DELETE) string is preceded by the allocator that
+     * provided it, so it can be freed, or moved by TransferTo(), without
+     * knowing its document. Owned strings are never written again, so
+     * clones share them (Share()) and the last reference frees them.
+     */
+    struct OwnedStrHeader {
+        XMLAllocator*   allocator;
+        size_t          size;
+#ifdef TINYXML2_HAS_THREADS
+        std::atomic<int> refs;
+#else
+        int             refs;
+#endif
+    };
+
     /*
      * decontrator - reset the object before deliting it.
      * */
@@ -195,7 +362,10 @@ namespace tinyxml2
     void StrPair::Reset()
     {
         if ( _flags & NEEDS_DELETE ) {
-            delete [] _start;
+            OwnedStrHeader* header = reinterpret_cast<OwnedStrHeader*>( _start ) - 1;
+            if ( --header->refs == 0 ) {
+                header->allocator->Deallocate( header, header->size );
+            }
         }
         _flags = 0;
         _start = 0;
@@ -206,18 +376,62 @@ namespace tinyxml2
     /**
      * Function: SetStr - set a new string object
      */
-    void StrPair::SetStr( const char* str, int flags )
+    void StrPair::SetStr( const char* str, int flags, XMLAllocator* allocator )
     {
         TIXMLASSERT( str );
         Reset();
         size_t len = strlen( str );
         TIXMLASSERT( _start == 0 );
-        _start = new char[ len+1 ];
+        if ( !allocator ) {
+            allocator = XMLAllocator::Default();
+        }
+        const size_t size = sizeof( OwnedStrHeader ) + len + 1;
+        OwnedStrHeader* header = new ( allocator->Allocate( size ) ) OwnedStrHeader;
+        header->allocator = allocator;
+        header->size = size;
+        header->refs = 1;
+        _start = reinterpret_cast<char*>( header + 1 );
         memcpy( _start, str, len+1 );
         _end = _start + len;
         _flags = flags | NEEDS_DELETE;
     }
 
+    /**
+     * Function: Share - make 'other' refer to the same string as 'this'
+     *           Only counted strings are shared. One in the parse buffer,
+     *           the string arena or interned is left to the caller to copy:
+     *           moving it here would write to a document others may read.
+     * @return true if 'other' now shares this string
+     */
+    bool StrPair::Share( StrPair* other )
+    {
+        TIXMLASSERT( other && other != this );
+        if ( !( _flags & NEEDS_DELETE ) ) {
+            return false;
+        }
+        // Normalize before there are two references to the memory.
+        GetStr();
+        other->Reset();
+        OwnedStrHeader* header = reinterpret_cast<OwnedStrHeader*>( _start ) - 1;
+        ++header->refs;
+        other->_flags = _flags;
+        other->_start = _start;
+        other->_end = _end;
+        return true;
+    }
+
+    /**
+     * Function: MakeShareable - move the string into counted memory from 'allocator', so Share() takes it
+     */
+    void StrPair::MakeShareable( XMLAllocator* allocator )
+    {
+        if ( _start && !( _flags & NEEDS_DELETE ) ) {
+            // Reset() leaves the memory that 'str' points into alone.
+            const char* str = GetStr();
+            SetStr( str, 0, allocator );
+        }
+    }
+
     /**
      * Function: ParseText - parse raw string to find its text value.
      *           check if the line has a specofog siffix and if so set a StrPair to the prefix
@@ -246,7 +460,7 @@ namespace tinyxml2
                 Set( start, p, strFlags );
                 return p + length;
             } else if (*p == '\n') {
-                ++(*curLineNumPtr);
+                XMLUtil::NextLine( curLineNumPtr );
             }
             ++p;
             TIXMLASSERT( p );
@@ -631,19 +845,63 @@ namespace tinyxml2
     }
 
     /*
-     * OVERLOAD Function: ToStr - operate 'snprintf' on the buffer
+     * Integer formatting for ToStr. Digits are generated back to front into
+     * a scratch buffer large enough for any 64 bit value, then copied out
+     * with the same truncation snprintf would apply. This is the printer's
+     * hot path for numeric attributes and text; no format string is parsed.
      */
+    static const int DIGIT_BUF_SIZE = 24;
+
+    static char* FormatDigits( uint64_t v, char* end )
+    {
+        *--end = 0;
+        do {
+            *--end = static_cast<char>( '0' + v % 10 );
+            v /= 10;
+        } while ( v );
+        return end;
+    }
+
+    static void CopyDigits( const char* digits, char* buffer, int bufferSize )
+    {
+        if ( bufferSize <= 0 ) {
+            return;
+        }
+        int i = 0;
+        for( ; i < bufferSize - 1 && digits[i]; ++i ) {
+            buffer[i] = digits[i];
+        }
+        buffer[i] = 0;
+    }
+
+    static void FormatSigned( int64_t v, char* buffer, int bufferSize )
+    {
+        char scratch[DIGIT_BUF_SIZE];
+        // Negate in unsigned arithmetic so INT64_MIN does not overflow.
+        const uint64_t magnitude = v < 0 ? 0 - static_cast<uint64_t>( v ) : static_cast<uint64_t>( v );
+        char* digits = FormatDigits( magnitude, scratch + DIGIT_BUF_SIZE );
+        if ( v < 0 ) {
+            *--digits = '-';
+        }
+        CopyDigits( digits, buffer, bufferSize );
+    }
+
+    static void FormatUnsigned( uint64_t v, char* buffer, int bufferSize )
+    {
+        char scratch[DIGIT_BUF_SIZE];
+        CopyDigits( FormatDigits( v, scratch + DIGIT_BUF_SIZE ), buffer, bufferSize );
+    }
 
 
     void XMLUtil::ToStr( int v, char* buffer, int bufferSize )
     {
-        TIXML_SNPRINTF( buffer, bufferSize, "%d", v );
+        FormatSigned( v, buffer, bufferSize );
     }
 
 
     void XMLUtil::ToStr( unsigned v, char* buffer, int bufferSize )
     {
-        TIXML_SNPRINTF( buffer, bufferSize, "%u", v );
+        FormatUnsigned( v, buffer, bufferSize );
     }
 
 
@@ -670,14 +928,12 @@ namespace tinyxml2
 
     void XMLUtil::ToStr( int64_t v, char* buffer, int bufferSize )
     {
-        // horrible syntax trick to make the compiler happy about %lld
-        TIXML_SNPRINTF(buffer, bufferSize, "%lld", static_cast<long long>(v));
+        FormatSigned( v, buffer, bufferSize );
     }
 
     void XMLUtil::ToStr( uint64_t v, char* buffer, int bufferSize )
     {
-        // horrible syntax trick to make the compiler happy about %llu
-        TIXML_SNPRINTF(buffer, bufferSize, "%llu", (long long)v);
+        FormatUnsigned( v, buffer, bufferSize );
     }
 
 
@@ -848,20 +1104,34 @@ namespace tinyxml2
         return p;
     }
 
+    /*
+     * Runs an XMLVisitor from Visit(): Accept() walks the tree through the
+     * parent links instead of recursing, whatever its depth.
+     */
+    struct XMLVirtualVisitor : public XMLStaticVisitor
+    {
+        explicit XMLVirtualVisitor( XMLVisitor* visitor ) : _visitor( visitor ) {}
+
+        bool EnterDocument( const XMLDocument& doc )                                { return _visitor->VisitEnter( doc ); }
+        bool ExitDocument( const XMLDocument& doc )                                 { return _visitor->VisitExit( doc ); }
+        bool EnterElement( const XMLElement& element, const XMLAttribute* attribute )   { return _visitor->VisitEnter( element, attribute ); }
+        bool ExitElement( const XMLElement& element )                               { return _visitor->VisitExit( element ); }
+        bool VisitDeclaration( const XMLDeclaration& declaration )                  { return _visitor->Visit( declaration ); }
+        bool VisitText( const XMLText& text )                                       { return _visitor->Visit( text ); }
+        bool VisitComment( const XMLComment& comment )                              { return _visitor->Visit( comment ); }
+        bool VisitUnknown( const XMLUnknown& unknown )                              { return _visitor->Visit( unknown ); }
+
+        XMLVisitor* _visitor;
+    };
+
     /*
      * Function: Accept -
      */
     bool XMLDocument::Accept( XMLVisitor* visitor ) const
     {
         TIXMLASSERT( visitor );
-        if ( visitor->VisitEnter( *this ) ) {
-            for ( const XMLNode* node=FirstChild(); node; node=node->NextSibling() ) {
-                if ( !node->Accept( visitor ) ) {
-                    break;
-                }
-            }
-        }
-        return visitor->VisitExit( *this );
+        XMLVirtualVisitor walk( visitor );
+        return Visit( *this, walk );
     }
 
 
@@ -870,15 +1140,18 @@ namespace tinyxml2
     /*
      * Constructor
      */
-    XMLNode::XMLNode( XMLDocument* doc ) :
+    XMLNode::XMLNode( XMLDocument* doc, NodeType type ) :
             _document( doc ),
             _parent( 0 ),
             _value(),
             _parseLineNum( 0 ),
+            _unlinkedIndex( -1 ),
+            _hash( 0 ),
             _firstChild( 0 ), _lastChild( 0 ),
             _prev( 0 ), _next( 0 ),
             _userData( 0 ),
-            _memPool( 0 )
+            _memPool( 0 ),
+            _nodeType( static_cast<unsigned char>( type ) )
     {
     }
 
@@ -913,8 +1186,9 @@ namespace tinyxml2
             _value.SetInternedStr( str );
         }
         else {
-            _value.SetStr( str );
+            _document->CopyString( &_value, str );
         }
+        InvalidateHash();
     }
 
     /**
@@ -928,12 +1202,36 @@ namespace tinyxml2
         XMLNode* clone = this->ShallowClone(target);
         if (!clone) return 0;
 
-        for (const XMLNode* child = this->FirstChild(); child; child = child->NextSibling()) {
-            XMLNode* childClone = child->DeepClone(target);
+        // Pre-order over the source, following the parent links rather
+        // than recursing; 'copy' is the clone of 'node'.
+        const XMLNode* node = this;
+        XMLNode* copy = clone;
+        for( ;; ) {
+            const XMLNode* next = node->_firstChild;
+            XMLNode* parent = copy;
+            if ( !next ) {
+                // The subtree of 'node' is copied: move on to the next
+                // sibling of it or of its nearest ancestor.
+                for( ;; ) {
+                    copy->_hash = node->_hash;      // equal subtrees hash the same
+                    if ( node == this ) {
+                        return clone;
+                    }
+                    if ( node->_next ) {
+                        next = node->_next;
+                        parent = copy->_parent;
+                        break;
+                    }
+                    node = node->_parent;
+                    copy = copy->_parent;
+                }
+            }
+            XMLNode* childClone = next->ShallowClone(target);
             TIXMLASSERT(childClone);
-            clone->InsertEndChild(childClone);
+            parent->InsertEndChild(childClone);
+            node = next;
+            copy = childClone;
         }
-        return clone;
     }
 
 
@@ -942,9 +1240,17 @@ namespace tinyxml2
     */
     void XMLNode::DeleteChildren()
     {
+        // Bottom up: every node is a leaf when it is deleted, so its
+        // destructor has nothing to delete and nothing recurses.
+        XMLNode* node = this;
         while( _firstChild ) {
             TIXMLASSERT( _lastChild );
-            DeleteChild( _firstChild );
+            while( node->_firstChild ) {
+                node = node->_firstChild;
+            }
+            XMLNode* parent = node->_parent;
+            parent->DeleteChild( node );
+            node = parent;
         }
         _firstChild = _lastChild = 0;
     }
@@ -973,6 +1279,7 @@ namespace tinyxml2
         child->_next = 0;
         child->_prev = 0;
         child->_parent = 0;
+        InvalidateHash();
     }
 
     /**
@@ -1025,6 +1332,7 @@ namespace tinyxml2
             addThis->_next = 0;
         }
         addThis->_parent = this;
+        InvalidateHash();
         return addThis;
     }
 
@@ -1064,6 +1372,7 @@ namespace tinyxml2
             addThis->_next = 0;
         }
         addThis->_parent = this;
+        InvalidateHash();
         return addThis;
     }
 
@@ -1109,11 +1418,184 @@ namespace tinyxml2
         afterThis->_next->_prev = addThis;
         afterThis->_next = addThis;
         addThis->_parent = this;
+        InvalidateHash();
         return addThis;
     }
 
 
 
+    /*
+     * Hashing: 64 bit FNV-1a over the strings, with the parts of a node
+     * and the hashes of its children folded in order.
+     */
+    static const uint64_t HASH_OFFSET = 0xcbf29ce484222325ULL;
+    static const uint64_t HASH_PRIME  = 0x00000100000001b3ULL;
+
+    static uint64_t HashString( uint64_t h, const char* str )
+    {
+        if ( str ) {
+            for( const unsigned char* p = reinterpret_cast<const unsigned char*>( str ); *p; ++p ) {
+                h = ( h ^ *p ) * HASH_PRIME;
+            }
+        }
+        // Terminate, so "ab","c" and "a","bc" differ.
+        return ( h ^ 0xff ) * HASH_PRIME;
+    }
+
+    // One round over a byte that is not part of a string, the node type: it
+    // gets its own step, so it never mixes with the first character.
+    static uint64_t HashByte( uint64_t h, unsigned char byte )
+    {
+        return ( h ^ byte ) * HASH_PRIME;
+    }
+
+    static uint64_t HashCombine( uint64_t h, uint64_t value )
+    {
+        h ^= value + 0x9e3779b97f4a7c15ULL + ( h << 6 ) + ( h >> 2 );
+        return h;
+    }
+
+    /*
+     * Function: HashShallow - hash of the node itself: its type, value and attributes
+     */
+    uint64_t XMLNode::HashShallow() const
+    {
+        uint64_t h = HashString( HashByte( HASH_OFFSET, static_cast<unsigned char>( Type() ) ), Value() );
+        if ( const XMLElement* element = ToElement() ) {
+            for( const XMLAttribute* a = element->FirstAttribute(); a; a = a->Next() ) {
+                h = HashString( HashString( h, a->Name() ), a->Value() );
+            }
+        }
+        return h;
+    }
+
+    /**
+     * Function: Hash - hash of the subtree, cached in each node
+     * @return
+     */
+    uint64_t XMLNode::Hash() const
+    {
+        if ( _hash ) {
+            return _hash;
+        }
+        // Post-order over the nodes without a cached hash, following the
+        // parent links rather than recursing: hashed subtrees are skipped.
+        const XMLNode* node = this;
+        for( ;; ) {
+            for( const XMLNode* child = node->_firstChild; child; ) {
+                if ( child->_hash ) {
+                    child = child->_next;
+                }
+                else {
+                    node = child;
+                    child = node->_firstChild;
+                }
+            }
+            // Every child of 'node' is hashed now.
+            for( ;; ) {
+                uint64_t h = node->HashShallow();
+                for( const XMLNode* child = node->_firstChild; child; child = child->_next ) {
+                    h = HashCombine( h, child->_hash );
+                }
+                node->_hash = h ? h : 1;    // 0 means not computed
+                if ( node == this ) {
+                    return _hash;
+                }
+                const XMLNode* next = node->_next;
+                while ( next && next->_hash ) {
+                    next = next->_next;
+                }
+                if ( next ) {
+                    node = next;
+                    break;
+                }
+                node = node->_parent;
+            }
+        }
+    }
+
+    /*
+     * Function: DeepEqualShallow - the node level part of DeepEqual(): type,
+     * value and attributes, names included
+     */
+    static bool DeepEqualShallow( const XMLNode* a, const XMLNode* b )
+    {
+        if ( a->Hash() != b->Hash() || a->Type() != b->Type() ) {
+            return false;
+        }
+        if ( a->ToDocument() ) {
+            return true;
+        }
+        if ( !XMLUtil::StringEqual( a->Value(), b->Value() ) ) {
+            return false;
+        }
+        const XMLElement* ea = a->ToElement();
+        if ( ea ) {
+            const XMLAttribute* x = ea->FirstAttribute();
+            const XMLAttribute* y = b->ToElement()->FirstAttribute();
+            for( ; x && y; x = x->Next(), y = y->Next() ) {
+                if ( !XMLUtil::StringEqual( x->Name(), y->Name() ) || !XMLUtil::StringEqual( x->Value(), y->Value() ) ) {
+                    return false;
+                }
+            }
+            if ( x || y ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Function: DeepEqual - compare two subtrees, rejecting on the hashes first
+     * @param compare
+     * @return
+     */
+    bool XMLNode::DeepEqual( const XMLNode* compare ) const
+    {
+        if ( !compare ) {
+            return false;
+        }
+        if ( compare == this ) {
+            return true;
+        }
+        if ( Hash() != compare->Hash() ) {
+            return false;
+        }
+        // Equal hashes: walk both trees in step, pre-order. Every node
+        // below is hashed now, so a differing subtree fails on its hash.
+        const XMLNode* a = this;
+        const XMLNode* b = compare;
+        for( ;; ) {
+            if ( !DeepEqualShallow( a, b ) ) {
+                return false;
+            }
+            if ( a->_firstChild || b->_firstChild ) {
+                if ( !a->_firstChild || !b->_firstChild ) {
+                    return false;
+                }
+                a = a->_firstChild;
+                b = b->_firstChild;
+                continue;
+            }
+            for( ;; ) {
+                if ( a == this ) {
+                    return true;
+                }
+                if ( a->_next || b->_next ) {
+                    if ( !a->_next || !b->_next ) {
+                        return false;
+                    }
+                    a = a->_next;
+                    b = b->_next;
+                    break;
+                }
+                a = a->_parent;
+                b = b->_parent;
+            }
+        }
+    }
+
+
     /** Get the first child element, or optionally the first child
         element with the specified name.
     */
@@ -1398,7 +1880,8 @@ namespace tinyxml2
         if ( !doc ) {
             doc = _document;
         }
-        XMLText* text = doc->NewText( Value() );	// fixme: this will always allocate memory. Intern?
+        XMLText* text = doc->CreateUnlinkedNode<XMLText>( doc->_textPool );
+        doc->ShareString( &text->_value, &_value, _document );
         text->SetCData( this->CData() );
         return text;
     }
@@ -1431,7 +1914,7 @@ namespace tinyxml2
      * Constructor
      * @param doc
      */
-    XMLComment::XMLComment( XMLDocument* doc ) : XMLNode( doc )
+    XMLComment::XMLComment( XMLDocument* doc ) : XMLNode( doc, COMMENT_NODE )
     {
     }
 
@@ -1468,7 +1951,8 @@ namespace tinyxml2
         if ( !doc ) {
             doc = _document;
         }
-        XMLComment* comment = doc->NewComment( Value() );	// fixme: this will always allocate memory. Intern?
+        XMLComment* comment = doc->CreateUnlinkedNode<XMLComment>( doc->_commentPool );
+        doc->ShareString( &comment->_value, &_value, _document );
         return comment;
     }
 
@@ -1499,7 +1983,7 @@ namespace tinyxml2
     /*
      * Constructor
      */
-    XMLDeclaration::XMLDeclaration( XMLDocument* doc ) : XMLNode( doc )
+    XMLDeclaration::XMLDeclaration( XMLDocument* doc ) : XMLNode( doc, DECLARATION_NODE )
     {
     }
 
@@ -1537,7 +2021,8 @@ namespace tinyxml2
         if ( !doc ) {
             doc = _document;
         }
-        XMLDeclaration* dec = doc->NewDeclaration( Value() );	// fixme: this will always allocate memory. Intern?
+        XMLDeclaration* dec = doc->CreateUnlinkedNode<XMLDeclaration>( doc->_commentPool );
+        doc->ShareString( &dec->_value, &_value, _document );
         return dec;
     }
 
@@ -1567,7 +2052,7 @@ namespace tinyxml2
      */
 
 
-    XMLUnknown::XMLUnknown( XMLDocument* doc ) : XMLNode( doc )
+    XMLUnknown::XMLUnknown( XMLDocument* doc ) : XMLNode( doc, UNKNOWN_NODE )
     {
     }
 
@@ -1602,7 +2087,8 @@ namespace tinyxml2
         if ( !doc ) {
             doc = _document;
         }
-        XMLUnknown* text = doc->NewUnknown( Value() );	// fixme: this will always allocate memory. Intern?
+        XMLUnknown* text = doc->CreateUnlinkedNode<XMLUnknown>( doc->_commentPool );
+        doc->ShareString( &text->_value, &_value, _document );
         return text;
     }
 
@@ -1688,7 +2174,7 @@ namespace tinyxml2
      */
     void XMLAttribute::SetName( const char* n )
     {
-        _name.SetStr( n );
+        _document->CopyString( &_name, n );
     }
 
     /**
@@ -1761,7 +2247,7 @@ namespace tinyxml2
 
     void XMLAttribute::SetAttribute( const char* v )
     {
-        _value.SetStr( v );
+        _document->CopyString( &_value, v );
     }
 
 
@@ -1769,7 +2255,7 @@ namespace tinyxml2
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr( v, buf, BUF_SIZE );
-        _value.SetStr( buf );
+        _document->CopyString( &_value, buf );
     }
 
 
@@ -1777,7 +2263,7 @@ namespace tinyxml2
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr( v, buf, BUF_SIZE );
-        _value.SetStr( buf );
+        _document->CopyString( &_value, buf );
     }
 
 
@@ -1785,14 +2271,14 @@ namespace tinyxml2
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr(v, buf, BUF_SIZE);
-        _value.SetStr(buf);
+        _document->CopyString( &_value, buf );
     }
 
     void XMLAttribute::SetAttribute(uint64_t v)
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr(v, buf, BUF_SIZE);
-        _value.SetStr(buf);
+        _document->CopyString( &_value, buf );
     }
 
 
@@ -1800,21 +2286,21 @@ namespace tinyxml2
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr( v, buf, BUF_SIZE );
-        _value.SetStr( buf );
+        _document->CopyString( &_value, buf );
     }
 
     void XMLAttribute::SetAttribute( double v )
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr( v, buf, BUF_SIZE );
-        _value.SetStr( buf );
+        _document->CopyString( &_value, buf );
     }
 
     void XMLAttribute::SetAttribute( float v )
     {
         char buf[BUF_SIZE];
         XMLUtil::ToStr( v, buf, BUF_SIZE );
-        _value.SetStr( buf );
+        _document->CopyString( &_value, buf );
     }
 
 
@@ -1822,7 +2308,7 @@ namespace tinyxml2
      * Class: XMLElement
      * -----------------
      */
-    XMLElement::XMLElement( XMLDocument* doc ) : XMLNode( doc ),
+    XMLElement::XMLElement( XMLDocument* doc ) : XMLNode( doc, ELEMENT_NODE ),
                                                  _closingType( OPEN ),
                                                  _rootAttribute( 0 )
     {
@@ -2199,6 +2685,8 @@ namespace tinyxml2
             }
             attrib->SetName( name );
         }
+        // The caller is about to set its value.
+        InvalidateHash();
         return attrib;
     }
 
@@ -2218,6 +2706,7 @@ namespace tinyxml2
                     _rootAttribute = a->_next;
                 }
                 DeleteAttribute( a );
+                InvalidateHash();
                 break;
             }
             prev = a;
@@ -2298,9 +2787,9 @@ namespace tinyxml2
         if ( attribute == 0 ) {
             return;
         }
-        MemPool* pool = attribute->_memPool;
+        XMLDocument* document = attribute->_document;
         attribute->~XMLAttribute();
-        pool->Free( attribute );
+        document->_attributePool.Free( attribute );
     }
 
 
@@ -2313,8 +2802,8 @@ namespace tinyxml2
         TIXMLASSERT( sizeof( XMLAttribute ) == _document->_attributePool.ItemSize() );
         XMLAttribute* attrib = new (_document->_attributePool.Alloc() ) XMLAttribute();
         TIXMLASSERT( attrib );
-        attrib->_memPool = &_document->_attributePool;
-        attrib->_memPool->SetTracked();
+        attrib->_document = _document;
+        _document->_attributePool.SetTracked();
         return attrib;
     }
 
@@ -2451,9 +2940,20 @@ namespace tinyxml2
         if ( !doc ) {
             doc = _document;
         }
-        XMLElement* element = doc->NewElement( Value() );					// fixme: this will always allocate memory. Intern?
-        for( const XMLAttribute* a=FirstAttribute(); a; a=a->Next() ) {
-            element->SetAttribute( a->Name(), a->Value() );					// fixme: this will always allocate memory. Intern?
+        XMLElement* element = doc->CreateUnlinkedNode<XMLElement>( doc->_elementPool );
+        doc->ShareString( &element->_value, &_value, _document );
+        XMLAttribute* last = 0;
+        for( XMLAttribute* a = _rootAttribute; a; a = a->_next ) {
+            XMLAttribute* attrib = element->CreateAttribute();
+            doc->ShareString( &attrib->_name, &a->_name, _document );
+            doc->ShareString( &attrib->_value, &a->_value, _document );
+            if ( last ) {
+                last->_next = attrib;
+            }
+            else {
+                element->_rootAttribute = attrib;
+            }
+            last = attrib;
         }
         return element;
     }
@@ -2462,14 +2962,8 @@ namespace tinyxml2
     bool XMLElement::Accept( XMLVisitor* visitor ) const
     {
         TIXMLASSERT( visitor );
-        if ( visitor->VisitEnter( *this, _rootAttribute ) ) {
-            for ( const XMLNode* node=FirstChild(); node; node=node->NextSibling() ) {
-                if ( !node->Accept( visitor ) ) {
-                    break;
-                }
-            }
-        }
-        return visitor->VisitExit( *this );
+        XMLVirtualVisitor walk( visitor );
+        return Visit( *this, walk );
     }
 
 
@@ -2498,14 +2992,16 @@ namespace tinyxml2
             "XML_ERROR_PARSING",
             "XML_CAN_NOT_CONVERT_TEXT",
             "XML_NO_TEXT_NODE",
-            "XML_ELEMENT_DEPTH_EXCEEDED"
+            "XML_ELEMENT_DEPTH_EXCEEDED",
+            "XML_ERROR_FILE_WRITE_ERROR",
+            "XML_ERROR_BAD_PATCH"
     };
 
     /*
      * Constructor
      */
     XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
-            XMLNode( 0 ),
+            XMLNode( 0, DOCUMENT_NODE ),
             _writeBOM( false ),
             _processEntities( processEntities ),
             _errorID(XML_SUCCESS),
@@ -2513,6 +3009,16 @@ namespace tinyxml2
             _errorStr(),
             _errorLineNum( 0 ),
             _charBuffer( 0 ),
+            _heapBuffer( 0 ),
+            _heapBufferSize( 0 ),
+            _reuseMode( false ),
+            _allocator( XMLAllocator::Default() ),
+            _useStringArena( false ),
+            _ownsHeapStrings( false ),
+            _arenaChunks( 0 ),
+            _arenaCur( 0 ),
+            _arenaEnd( 0 ),
+            _arenaNextChunk( 0 ),
             _parseCurLineNum( 0 ),
             _parsingDepth(0),
             _unlinked(),
@@ -2531,24 +3037,30 @@ namespace tinyxml2
     XMLDocument::~XMLDocument()
     {
         Clear();
+        ReleaseHeapBuffer();
     }
 
     /**
-     * Function: MarkInUse - walk trought the "unlink" nodes of 'this' and check if 'node' is one of them.
-     *                      if so - mark 'node' as "inUse" by removing it from thr "unlinked" array.
-     * @param node - a node to compare with the "unlinked" of 'this'
+     * Function: MarkInUse - take 'node' out of the unlinked list, if it is in it.
+     *           Nodes remember their slot, so this is O(1).
+     * @param node
      */
-    void XMLDocument::MarkInUse(const XMLNode* const node)
+    void XMLDocument::MarkInUse(XMLNode* node)
     {
         TIXMLASSERT(node);
         TIXMLASSERT(node->_parent == 0);
 
-        for (int i = 0; i < _unlinked.Size(); ++i) {
-            if (node == _unlinked[i]) {
-                _unlinked.SwapRemove(i);
-                break;
-            }
+        const int i = node->_unlinkedIndex;
+        if (i < 0) {
+            return;
+        }
+        const size_t slot = static_cast<size_t>(i);
+        TIXMLASSERT(slot < _unlinked.Size() && _unlinked[slot] == node);
+        _unlinked.SwapRemove(slot);
+        if (slot < _unlinked.Size()) {
+            _unlinked[slot]->_unlinkedIndex = i;
         }
+        node->_unlinkedIndex = -1;
     }
 
     /**
@@ -2556,18 +3068,45 @@ namespace tinyxml2
      */
     void XMLDocument::Clear()
     {
-        DeleteChildren();
-        while( _unlinked.Size()) {
-            DeleteNode(_unlinked[0]);	// Will remove from _unlinked as part of delete.
+        _hash = 0;
+        if ( _ownsHeapStrings ) {
+            DeleteChildren();
+            while( _unlinked.Size()) {
+                DeleteNode(_unlinked[0]);	// Will remove from _unlinked as part of delete.
+            }
+        }
+        else if ( _reuseMode ) {
+            // As below, but keep the blocks for the next document.
+            _firstChild = _lastChild = 0;
+            _unlinked.Clear();
+            _elementPool.Reset();
+            _attributePool.Reset();
+            _textPool.Reset();
+            _commentPool.Reset();
+        }
+        else {
+            // Every node, attribute and string lives in the pools, the
+            // char buffer or the arena: release those wholesale instead
+            // of destroying the nodes one by one.
+            _firstChild = _lastChild = 0;
+            _unlinked.Clear();
+            _elementPool.Clear();
+            _attributePool.Clear();
+            _textPool.Clear();
+            _commentPool.Clear();
         }
+        _ownsHeapStrings = false;
 
 #ifdef TINYXML2_DEBUG
         const bool hadError = Error();
 #endif
         ClearError();
 
-        delete [] _charBuffer;
         _charBuffer = 0;
+        if ( !_reuseMode ) {
+            ReleaseHeapBuffer();
+        }
+        ClearArena();
         _parsingDepth = 0;
 
 #if 0
@@ -2588,60 +3127,369 @@ namespace tinyxml2
     }
 
     /**
-     * Function: DeepCopy - copy the 'this' document to 'target'
-     * @param target
+     * Function: SetAllocator - clear the document and move all of its memory to 'allocator'
+     * @param allocator
      */
-    void XMLDocument::DeepCopy(XMLDocument* target) const
+    void XMLDocument::SetAllocator( XMLAllocator* allocator )
     {
-        TIXMLASSERT(target);
-        if (target == this) {
-            return; // technically success - a no-op.
-        }
-
-        target->Clear();
-        for (const XMLNode* node = this->FirstChild(); node; node = node->NextSibling()) {
-            target->InsertEndChild(node->DeepClone(target));
+        if ( !allocator ) {
+            allocator = XMLAllocator::Default();
         }
+        Clear();
+        ReleaseHeapBuffer();
+        _elementPool.SetAllocator( allocator );
+        _attributePool.SetAllocator( allocator );
+        _textPool.SetAllocator( allocator );
+        _commentPool.SetAllocator( allocator );
+        _unlinked.SetAllocator( allocator );
+        _allocator = allocator;
     }
 
     /**
-     * Function: NewElement - create new element as unlinked
+     * Function: AllocCharBuffer - allocate the character buffer from the document allocator
+     * @param size
+     * @return
      */
-    XMLElement* XMLDocument::NewElement( const char* name )
+    char* XMLDocument::AllocCharBuffer( size_t size )
     {
-        XMLElement* ele = CreateUnlinkedNode<XMLElement>( _elementPool );
-        ele->SetName( name );
-        return ele;
+        TIXMLASSERT( _charBuffer == 0 );
+        if ( size <= sizeof( _inlineBuffer ) ) {
+            _charBuffer = _inlineBuffer;
+            return _charBuffer;
+        }
+        if ( _heapBufferSize < size ) {
+            ReleaseHeapBuffer();
+            _heapBuffer = static_cast<char*>( _allocator->Allocate( size ) );
+            _heapBufferSize = size;
+        }
+        _charBuffer = _heapBuffer;
+        return _charBuffer;
     }
 
     /**
-     * Function: NewComment - create new Comment as unlinked
+     * Function: GrowCharBuffer - grow the character buffer in use, keeping its contents
+     * @param used  bytes to keep
+     * @param size  new size
+     * @return
      */
-    XMLComment* XMLDocument::NewComment( const char* str )
+    char* XMLDocument::GrowCharBuffer( size_t used, size_t size )
     {
-        XMLComment* comment = CreateUnlinkedNode<XMLComment>( _commentPool );
-        comment->SetValue( str );
-        return comment;
+        TIXMLASSERT( _charBuffer );
+        TIXMLASSERT( used <= size );
+        if ( _charBuffer == _heapBuffer ) {
+            _heapBuffer = static_cast<char*>( _allocator->Reallocate( _heapBuffer, _heapBufferSize, size ) );
+        }
+        else {
+            ReleaseHeapBuffer();
+            _heapBuffer = static_cast<char*>( _allocator->Allocate( size ) );
+            memcpy( _heapBuffer, _charBuffer, used );
+        }
+        _heapBufferSize = size;
+        _charBuffer = _heapBuffer;
+        return _charBuffer;
     }
 
     /**
-     * Function: NewText - create new Text item as unlinked
+     * Function: ReleaseHeapBuffer - give the heap buffer back to the allocator
      */
-    XMLText* XMLDocument::NewText( const char* str )
+    void XMLDocument::ReleaseHeapBuffer()
     {
-        XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
-        text->SetValue( str );
-        return text;
+        TIXMLASSERT( _charBuffer == 0 || _charBuffer == _inlineBuffer );
+        if ( _heapBuffer ) {
+            _allocator->Deallocate( _heapBuffer, _heapBufferSize );
+            _heapBuffer = 0;
+            _heapBufferSize = 0;
+        }
     }
 
     /**
-     * Function: NewDeclaration - create new Declaration item as unlinked - has a default one
+     * Function: SetReuseMode - keep (or stop keeping) buffers and pool blocks across Clear()
+     * @param reuse
      */
-    XMLDeclaration* XMLDocument::NewDeclaration( const char* str )
+    void XMLDocument::SetReuseMode( bool reuse )
     {
-        XMLDeclaration* dec = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
-        dec->SetValue( str ? str : "xml version=\"1.0\" encoding=\"UTF-8\"" );
-        return dec;
+        _reuseMode = reuse;
+        if ( !reuse && !_charBuffer ) {
+            ReleaseHeapBuffer();
+        }
+    }
+
+    /*
+     * A chunk of the string arena; the strings follow the header.
+     */
+    struct XMLDocument::ArenaChunk {
+        ArenaChunk* next;
+        size_t      size;      // including this header
+    };
+
+    // Chunks double from the first size to the last; strings larger
+    // than a quarter of the first chunk get a chunk of their own.
+    static const size_t ARENA_FIRST_CHUNK = 4 * 1024;
+    static const size_t ARENA_MAX_CHUNK = 1024 * 1024;
+
+    /**
+     * Function: CopyString - copy 'value' into 'str', owned by the allocator or by the string arena
+     * @param str
+     * @param value
+     * @param flags
+     */
+    void XMLDocument::CopyString( StrPair* str, const char* value, int flags )
+    {
+        TIXMLASSERT( value );
+        if ( !_useStringArena ) {
+            str->SetStr( value, flags, _allocator );
+            _ownsHeapStrings = true;
+            return;
+        }
+        const size_t len = strlen( value );
+        char* mem = ArenaAlloc( len+1 );
+        memcpy( mem, value, len+1 );
+        str->Set( mem, mem + len, flags );
+    }
+
+    /**
+     * Function: ShareString - point 'str' at the string of 'source', a name or value in 'owner'
+     *           Counted strings are shared, not copied; a later SetValue() or
+     *           SetAttribute() on either side replaces its own reference only.
+     *           A shared string is freed through the allocator of 'owner', so
+     *           documents with different allocators copy instead. So do strings
+     *           that aren't counted: 'owner' is never written.
+     */
+    void XMLDocument::ShareString( StrPair* str, StrPair* source, XMLDocument* owner )
+    {
+        TIXMLASSERT( owner );
+        if ( owner->_allocator == _allocator && source->Share( str ) ) {
+            _ownsHeapStrings = true;
+            return;
+        }
+        CopyString( str, source->GetStr() );
+    }
+
+    /**
+     * Function: ArenaAlloc - bump allocate 'size' bytes from the string arena
+     * @param size
+     * @return
+     */
+    char* XMLDocument::ArenaAlloc( size_t size )
+    {
+        if ( size > static_cast<size_t>( _arenaEnd - _arenaCur ) ) {
+            if ( _arenaNextChunk == 0 ) {
+                _arenaNextChunk = ARENA_FIRST_CHUNK;
+            }
+            const bool dedicated = size > ARENA_FIRST_CHUNK / 4;
+            const size_t chunkSize = sizeof( ArenaChunk ) + ( dedicated ? size : _arenaNextChunk );
+            ArenaChunk* chunk = static_cast<ArenaChunk*>( _allocator->Allocate( chunkSize ) );
+            chunk->size = chunkSize;
+            char* mem = reinterpret_cast<char*>( chunk + 1 );
+            if ( dedicated && _arenaChunks ) {
+                // Keep bumping in the current chunk.
+                chunk->next = _arenaChunks->next;
+                _arenaChunks->next = chunk;
+                return mem;
+            }
+            chunk->next = _arenaChunks;
+            _arenaChunks = chunk;
+            _arenaCur = mem;
+            _arenaEnd = mem + ( chunkSize - sizeof( ArenaChunk ) );
+            if ( !dedicated && _arenaNextChunk < ARENA_MAX_CHUNK ) {
+                _arenaNextChunk *= 2;
+            }
+        }
+        char* mem = _arenaCur;
+        _arenaCur += size;
+        return mem;
+    }
+
+    /**
+     * Function: ClearArena - release every chunk of the string arena
+     */
+    void XMLDocument::ClearArena()
+    {
+        while ( _arenaChunks ) {
+            ArenaChunk* next = _arenaChunks->next;
+            _allocator->Deallocate( _arenaChunks, _arenaChunks->size );
+            _arenaChunks = next;
+        }
+        _arenaCur = 0;
+        _arenaEnd = 0;
+        _arenaNextChunk = 0;
+    }
+
+    /**
+     * Function: SetPoolPolicy - apply the block policy to all the pools of the document
+     * @param policy
+     */
+    void XMLDocument::SetPoolPolicy( const XMLPoolPolicy& policy )
+    {
+        _elementPool.SetPolicy( policy );
+        _attributePool.SetPolicy( policy );
+        _textPool.SetPolicy( policy );
+        _commentPool.SetPolicy( policy );
+    }
+
+    /**
+     * Function: DeepCopy - copy the 'this' document to 'target'
+     * @param target
+     */
+    void XMLDocument::DeepCopy(XMLDocument* target) const
+    {
+        TIXMLASSERT(target);
+        if (target == this) {
+            return; // technically success - a no-op.
+        }
+
+        target->Clear();
+        for (const XMLNode* node = this->FirstChild(); node; node = node->NextSibling()) {
+            target->InsertEndChild(node->DeepClone(target));
+        }
+        target->_hash = _hash;
+    }
+
+#ifdef TINYXML2_HAS_THREADS
+    /*
+     * Threads started for one call. Join(), or the destructor when starting
+     * a thread or the caller's own work throws, waits for those started.
+     */
+    class XMLThreadGroup
+    {
+    public:
+        explicit XMLThreadGroup( int size ) : _threads( new std::thread[size] ), _started( 0 ) {}
+        ~XMLThreadGroup() {
+            Join();
+            delete [] _threads;
+        }
+
+        template< class Function, class Argument >
+        void Start( Function function, Argument argument ) {
+            _threads[_started] = std::thread( function, argument );
+            ++_started;
+        }
+
+        void Join() {
+            while ( _started > 0 ) {
+                _threads[--_started].join();
+            }
+        }
+
+    private:
+        XMLThreadGroup( const XMLThreadGroup& );    // not supported
+        void operator=( const XMLThreadGroup& );    // not supported
+
+        std::thread*    _threads;
+        int             _started;
+    };
+
+    /*
+     * The children of the split node, hashed by the workers in turn.
+     */
+    struct XMLFinalizeJob {
+        DynArray<const XMLNode*, 16>    nodes;
+        std::atomic<size_t>             next;
+    };
+
+    static void FinalizeWorker( XMLFinalizeJob* job )
+    {
+        for( size_t i = job->next++; i < job->nodes.Size(); i = job->next++ ) {
+            job->nodes[i]->Hash();
+        }
+    }
+#endif
+
+    /**
+     * Function: FinalizeStrings - normalize every string and fill the hash cache
+     *           Hash() reads every name and value, which normalizes them.
+     * @param threads
+     */
+    void XMLDocument::FinalizeStrings( int threads )
+    {
+#ifdef TINYXML2_HAS_THREADS
+        if ( threads <= 0 ) {
+            threads = static_cast<int>( std::thread::hardware_concurrency() );
+        }
+        // Split at the root, or at the first element below a chain of
+        // single children; the rest is hashed below.
+        const XMLNode* split = RootElement();
+        while ( split && split->FirstChild() && !split->FirstChild()->NextSibling() ) {
+            split = split->FirstChild();
+        }
+        if ( threads > 1 && split && split->FirstChild() ) {
+            XMLFinalizeJob job;
+            for( const XMLNode* node = split->FirstChild(); node; node = node->NextSibling() ) {
+                job.nodes.Push( node );
+            }
+            job.next = 0;
+            const int workers = static_cast<size_t>( threads ) < job.nodes.Size() ? threads : static_cast<int>( job.nodes.Size() );
+            XMLThreadGroup pool( workers );
+            for( int i = 0; i < workers; ++i ) {
+                pool.Start( FinalizeWorker, &job );
+            }
+            pool.Join();
+        }
+#else
+        (void)threads;
+#endif
+        Hash();
+
+        // Move the names and values into counted memory, so that clones
+        // and copies share them and only count references.
+        for( XMLNode* node = _firstChild; node; ) {
+            node->_value.MakeShareable( _allocator );
+            if ( XMLElement* element = node->ToElement() ) {
+                for( XMLAttribute* a = element->_rootAttribute; a; a = a->_next ) {
+                    a->_name.MakeShareable( _allocator );
+                    a->_value.MakeShareable( _allocator );
+                }
+            }
+            _ownsHeapStrings = true;
+            if ( node->_firstChild ) {
+                node = node->_firstChild;
+                continue;
+            }
+            while ( node != this && !node->_next ) {
+                node = node->_parent;
+            }
+            node = node == this ? 0 : node->_next;
+        }
+    }
+
+    /**
+     * Function: NewElement - create new element as unlinked
+     */
+    XMLElement* XMLDocument::NewElement( const char* name )
+    {
+        XMLElement* ele = CreateUnlinkedNode<XMLElement>( _elementPool );
+        ele->SetName( name );
+        return ele;
+    }
+
+    /**
+     * Function: NewComment - create new Comment as unlinked
+     */
+    XMLComment* XMLDocument::NewComment( const char* str )
+    {
+        XMLComment* comment = CreateUnlinkedNode<XMLComment>( _commentPool );
+        comment->SetValue( str );
+        return comment;
+    }
+
+    /**
+     * Function: NewText - create new Text item as unlinked
+     */
+    XMLText* XMLDocument::NewText( const char* str )
+    {
+        XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
+        text->SetValue( str );
+        return text;
+    }
+
+    /**
+     * Function: NewDeclaration - create new Declaration item as unlinked - has a default one
+     */
+    XMLDeclaration* XMLDocument::NewDeclaration( const char* str )
+    {
+        XMLDeclaration* dec = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
+        dec->SetValue( str ? str : "xml version=\"1.0\" encoding=\"UTF-8\"" );
+        return dec;
     }
 
     /**
@@ -2764,9 +3612,20 @@ namespace tinyxml2
             return _errorID;
         }
 
+#ifdef TINYXML2_HAS_ZLIB
+        if ( filelength >= 2 ) {
+            const int magic0 = fgetc( fp );
+            const int magic1 = fgetc( fp );
+            TIXML_FSEEK( fp, 0, SEEK_SET );
+            if ( magic0 == 0x1f && magic1 == 0x8b ) {
+                return LoadGzip( fp, static_cast<size_t>(filelength) );
+            }
+        }
+#endif
+
         const size_t size = static_cast<size_t>(filelength);
         TIXMLASSERT( _charBuffer == 0 );
-        _charBuffer = new char[size+1];
+        AllocCharBuffer( size+1 );
         const size_t read = fread( _charBuffer, 1, size, fp );
         if ( read != size ) {
             SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
@@ -2779,6 +3638,99 @@ namespace tinyxml2
         return _errorID;
     }
 
+#ifdef TINYXML2_HAS_ZLIB
+    /**
+     * Function: LoadGzip - inflate a gzip file straight into the character buffer, and parse it
+     * @param fp
+     * @param compressedSize
+     * @return
+     */
+    XMLError XMLDocument::LoadGzip( FILE* fp, size_t compressedSize )
+    {
+        // The trailer of the last member holds its inflated size (mod 2^32),
+        // exact for the usual single member file. Trust it no further than
+        // deflate's best ratio; the buffer grows if the guess is short.
+        size_t guess = 0;
+        unsigned char trailer[4];
+        if ( compressedSize >= 18 && TIXML_FSEEK( fp, -4, SEEK_END ) == 0 && fread( trailer, 1, 4, fp ) == 4 ) {
+            guess = static_cast<size_t>( trailer[0] | ( trailer[1] << 8 ) | ( trailer[2] << 16 ) | ( unsigned( trailer[3] ) << 24 ) );
+        }
+        TIXML_FSEEK( fp, 0, SEEK_SET );
+        const size_t maxRatio = 1032;
+        if ( guess == 0 || guess / maxRatio > compressedSize ) {
+            guess = compressedSize * 4;
+        }
+        size_t capacity = guess + 1;
+
+        z_stream z;
+        memset( &z, 0, sizeof( z ) );
+        if ( inflateInit2( &z, 15 + 16 ) != Z_OK ) {
+            SetError( XML_ERROR_FILE_READ_ERROR, 0, "gzip: %s", z.msg ? z.msg : "inflateInit failed" );
+            return _errorID;
+        }
+
+        TIXMLASSERT( _charBuffer == 0 );
+        AllocCharBuffer( capacity );
+        if ( _charBuffer == _heapBuffer && _heapBufferSize > capacity ) {
+            capacity = _heapBufferSize;     // a larger buffer kept by reuse mode
+        }
+        size_t size = 0;
+        int result = Z_OK;
+        Bytef in[16 * 1024];
+        for( ;; ) {
+            if ( z.avail_in == 0 ) {
+                const size_t read = fread( in, 1, sizeof( in ), fp );
+                if ( read == 0 ) {
+                    break;
+                }
+                z.next_in = in;
+                z.avail_in = static_cast<uInt>( read );
+            }
+            if ( result == Z_STREAM_END ) {
+                // Concatenated members make one document, as with gunzip.
+                inflateReset( &z );
+            }
+            const size_t room = capacity - 1 - size;
+            z.next_out = reinterpret_cast<Bytef*>( _charBuffer + size );
+            z.avail_out = room < static_cast<uInt>(-1) ? static_cast<uInt>( room ) : static_cast<uInt>(-1);
+            result = inflate( &z, Z_NO_FLUSH );
+            size = static_cast<size_t>( reinterpret_cast<char*>( z.next_out ) - _charBuffer );
+            if ( result == Z_BUF_ERROR && z.avail_out == 0 ) {
+                if ( capacity > static_cast<size_t>(-1) / 2 ) {
+                    result = Z_MEM_ERROR;
+                    break;
+                }
+                capacity *= 2;
+                GrowCharBuffer( size, capacity );
+                result = Z_OK;
+                continue;
+            }
+            if ( result != Z_OK && result != Z_STREAM_END ) {
+                break;
+            }
+        }
+        const char* message = z.msg;
+        inflateEnd( &z );
+
+        if ( ferror( fp ) ) {
+            SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
+            return _errorID;
+        }
+        if ( result != Z_STREAM_END ) {
+            SetError( XML_ERROR_FILE_READ_ERROR, 0, "gzip: %s", message ? message : "truncated" );
+            return _errorID;
+        }
+        if ( size == 0 ) {
+            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+            return _errorID;
+        }
+        _charBuffer[size] = 0;
+
+        Parse();
+        return _errorID;
+    }
+#endif
+
     /**
      * Function: SaveFile - open the file that will contain the saved data
      * @param filename
@@ -2819,666 +3771,2936 @@ namespace tinyxml2
         return _errorID;
     }
 
+#ifdef TINYXML2_HAS_ZLIB
     /**
-     * Function: Parse - envelope parsing - first validation
-     * @param p
-     * @param len
+     * Function: SaveFileCompressed - save the document gzip compressed
+     * @param filename
+     * @param level
+     * @param compact
      * @return
      */
-    XMLError XMLDocument::Parse( const char* p, size_t len )
+    XMLError XMLDocument::SaveFileCompressed( const char* filename, int level, bool compact )
     {
-        Clear();
+        if ( !filename ) {
+            TIXMLASSERT( false );
+            SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+            return _errorID;
+        }
 
-        if ( len == 0 || !p || !*p ) {
-            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+        FILE* fp = callfopen( filename, "wb" );
+        if ( !fp ) {
+            SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
             return _errorID;
         }
-        if ( len == static_cast<size_t>(-1) ) {
-            len = strlen( p );
+        ClearError();
+        bool ok = false;
+        {
+            XMLFileSink file( fp );
+            XMLGzipSink gzip( file, level );
+            XMLPrinter stream( gzip, compact );
+            Print( &stream );
+            // The printer hands its last output to the sink at the end of
+            // the document; a failed write leaves the sink failed.
+            ok = gzip.Finish();
         }
-        TIXMLASSERT( _charBuffer == 0 );
-        _charBuffer = new char[ len+1 ];
-        memcpy( _charBuffer, p, len );
-        _charBuffer[len] = 0;
-
-        Parse();
-        if ( Error() ) {
-            // clean up now essentially dangling memory.
-            // and the parse fail can put objects in the
-            // pools that are dead and inaccessible.
-            DeleteChildren();
-            _elementPool.Clear();
-            _attributePool.Clear();
-            _textPool.Clear();
-            _commentPool.Clear();
+        if ( fclose( fp ) != 0 || !ok ) {
+            SetError( XML_ERROR_FILE_WRITE_ERROR, 0, "filename=%s", filename );
         }
         return _errorID;
     }
+#endif
 
-    /**
-     * Function: Print - print the documents
-     * @param streamer
+#ifdef TINYXML2_HAS_THREADS
+    /*
+     * Output sink of SaveFileAsync(), and the thread that drains it. The
+     * printing thread copies each chunk into a buffer and queues it, never
+     * waiting for the disk; the writer thread opens the file and writes
+     * the queued buffers in order, and keeps up to 'spare' of them for
+     * reuse. After a failure the writer discards whatever is still queued
+     * and Write() refuses new chunks.
      */
-    void XMLDocument::Print( XMLPrinter* streamer ) const
-    {
-        if ( streamer ) {
-            Accept( streamer );
+    class XMLAsyncSave::Writer : public XMLOutputSink
+    {
+    public:
+        Writer( const char* filename, int spare ) :
+            _spare( spare > 0 ? spare : 1 ),
+            _closed( false ),
+            _failed( false ),
+            _error( XML_SUCCESS ),
+            _finished( false )
+        {
+            const size_t len = strlen( filename );
+            memcpy( _filename.PushArr( len + 1 ), filename, len + 1 );
+            _thread = std::thread( &Writer::Run, this );
         }
-        else {
-            XMLPrinter stdoutStreamer( stdout );
-            Accept( &stdoutStreamer );
+
+        ~Writer() {
+            TIXMLASSERT( !_thread.joinable() );
+            while ( !_queue.Empty() ) {
+                delete _queue.Pop();
+            }
+            while ( !_free.Empty() ) {
+                delete _free.Pop();
+            }
         }
-    }
 
-    /**
-     * Function: SetError - log error
-     * @param error
-     * @param lineNum
-     * @param format
-     * @param ...
-     */
-    void XMLDocument::SetError( XMLError error, int lineNum, const char* format, ... )
-    {
-        TIXMLASSERT( error >= 0 && error < XML_ERROR_COUNT );
-        _errorID = error;
-        _errorLineNum = lineNum;
-        _errorStr.Reset();
+        virtual bool Write( const char* data, size_t size ) {
+            DynArray<char, 1>* buffer = 0;
+            {
+                std::lock_guard<std::mutex> lock( _mutex );
+                if ( _failed ) {
+                    return false;
+                }
+                if ( !_free.Empty() ) {
+                    buffer = _free.Pop();
+                }
+            }
+            if ( !buffer ) {
+                buffer = new DynArray<char, 1>;
+            }
+            buffer->Clear();
+            memcpy( buffer->PushArr( size ), data, size );
+            {
+                std::lock_guard<std::mutex> lock( _mutex );
+                _queue.Push( buffer );
+            }
+            _filled.notify_one();
+            return true;
+        }
 
-        const size_t BUFFER_SIZE = 1000;
-        char* buffer = new char[BUFFER_SIZE];
+        // No more chunks; the writer drains the queue and closes the file.
+        void Close() {
+            {
+                std::lock_guard<std::mutex> lock( _mutex );
+                _closed = true;
+            }
+            _filled.notify_one();
+        }
 
-        TIXMLASSERT(sizeof(error) <= sizeof(int));
-        TIXML_SNPRINTF(buffer, BUFFER_SIZE, "Error=%s ErrorID=%d (0x%x) Line number=%d", ErrorIDToName(error), int(error), int(error), lineNum);
-
-        if (format) {
-            size_t len = strlen(buffer);
-            TIXML_SNPRINTF(buffer + len, BUFFER_SIZE - len, ": ");
-            len = strlen(buffer);
+        XMLError Join() {
+            if ( _thread.joinable() ) {
+                _thread.join();
+            }
+            return _error;
+        }
 
-            va_list va;
-            va_start(va, format);
-            TIXML_VSNPRINTF(buffer + len, BUFFER_SIZE - len, format, va);
-            va_end(va);
+        bool Finished() const {
+            return _finished.load( std::memory_order_acquire );
         }
-        _errorStr.SetStr(buffer);
-        delete[] buffer;
-    }
 
-    /**
-     * Function: ErrorIDToName - convert error id to name
-     * @param errorID
-     * @return
-     */
-/*static*/ const char* XMLDocument::ErrorIDToName(XMLError errorID)
-    {
-        TIXMLASSERT( errorID >= 0 && errorID < XML_ERROR_COUNT );
-        const char* errorName = _errorNames[errorID];
-        TIXMLASSERT( errorName && errorName[0] );
-        return errorName;
-    }
+    private:
+        Writer( const Writer& );            // not supported
+        void operator=( const Writer& );    // not supported
 
-    /**
-     * Function: ErrorStr = returns error string
-     * @return
-     */
-    const char* XMLDocument::ErrorStr() const
-    {
-        return _errorStr.Empty() ? "" : _errorStr.GetStr();
-    }
+        void Run() {
+            FILE* fp = callfopen( _filename.Mem(), "w" );
+            XMLError error = fp ? XML_SUCCESS : XML_ERROR_FILE_COULD_NOT_BE_OPENED;
+            DynArray<DynArray<char, 1>*, 16> batch;
+            for( ;; ) {
+                {
+                    std::unique_lock<std::mutex> lock( _mutex );
+                    _failed = error != XML_SUCCESS;
+                    while ( !_closed && _queue.Empty() ) {
+                        _filled.wait( lock );
+                    }
+                    if ( _queue.Empty() ) {
+                        break;
+                    }
+                    // Take all that is queued, in order.
+                    memcpy( batch.PushArr( _queue.Size() ), _queue.Mem(), _queue.Size() * sizeof( DynArray<char, 1>* ) );
+                    _queue.Clear();
+                }
+                for( size_t i = 0; i < batch.Size() && error == XML_SUCCESS; ++i ) {
+                    if ( fwrite( batch[i]->Mem(), 1, batch[i]->Size(), fp ) != batch[i]->Size() ) {
+                        error = XML_ERROR_FILE_WRITE_ERROR;
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lock( _mutex );
+                    while ( !batch.Empty() ) {
+                        DynArray<char, 1>* buffer = batch.Pop();
+                        if ( _free.Size() < _spare ) {
+                            _free.Push( buffer );
+                        }
+                        else {
+                            delete buffer;
+                        }
+                    }
+                }
+            }
+            if ( fp && fclose( fp ) != 0 && error == XML_SUCCESS ) {
+                error = XML_ERROR_FILE_WRITE_ERROR;
+            }
+            _error = error;
+            _finished.store( true, std::memory_order_release );
+        }
+
+        const size_t                        _spare;     // written buffers kept for reuse
+        DynArray<DynArray<char, 1>*, 16>    _queue;     // filled buffers waiting for the writer
+        DynArray<DynArray<char, 1>*, 16>    _free;
+        bool                                _closed;
+        bool                                _failed;
+        XMLError                            _error;
+        std::atomic<bool>                   _finished;
+        DynArray<char, 64>                  _filename;
+        std::mutex                          _mutex;
+        std::condition_variable             _filled;    // a buffer was queued, or the sink closed
+        std::thread                         _thread;
+    };
 
     /**
-     * Function: PrintError
+     * Function: SaveFileAsync - print the document into a queue of buffers that
+     *           a background thread writes to 'filename'
+     * @param filename
+     * @param compact
+     * @param buffers
+     * @return handle reporting the result of the write
      */
-    void XMLDocument::PrintError() const
+    XMLAsyncSave XMLDocument::SaveFileAsync( const char* filename, bool compact, int buffers )
     {
-        printf("%s\n", ErrorStr());
+        if ( !filename ) {
+            TIXMLASSERT( false );
+            return XMLAsyncSave( XML_ERROR_FILE_COULD_NOT_BE_OPENED );
+        }
+        XMLAsyncSave::Writer* writer = new XMLAsyncSave::Writer( filename, buffers );
+        {
+            XMLPrinter stream( *writer, compact );
+            Print( &stream );
+            stream.Flush();
+        }
+        writer->Close();
+        return XMLAsyncSave( writer );
     }
 
-    /**
-     * Function: ErrorName - return the text error value based on error id
-     * @return
-     */
-    const char* XMLDocument::ErrorName() const
+    XMLAsyncSave& XMLAsyncSave::operator=( XMLAsyncSave&& other )
     {
-        return ErrorIDToName(_errorID);
+        if ( this != &other ) {
+            Wait();
+            _writer = other._writer;
+            _result = other._result;
+            other._writer = 0;
+        }
+        return *this;
     }
 
-    /**
-     * Function: Parse - parsing envelope - step 2 - start the recursive methos ParseDeep
-     */
-    void XMLDocument::Parse()
+    bool XMLAsyncSave::Done() const
     {
-        TIXMLASSERT( NoChildren() ); // Clear() must have been called previously
-        TIXMLASSERT( _charBuffer );
-        _parseCurLineNum = 1;
-        _parseLineNum = 1;
-        char* p = _charBuffer;
-        p = XMLUtil::SkipWhiteSpace( p, &_parseCurLineNum );
-        p = const_cast<char*>( XMLUtil::ReadBOM( p, &_writeBOM ) );
-        if ( !*p ) {
-            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
-            return;
-        }
-        ParseDeep(p, 0, &_parseCurLineNum );
+        return !_writer || _writer->Finished();
     }
 
-    /**
-     * Function: PushDepth - increase the depth of the document by one - checking that no over the MAX
-     */
-    void XMLDocument::PushDepth()
+    XMLError XMLAsyncSave::Wait()
     {
-        _parsingDepth++;
-        if (_parsingDepth == TINYXML2_MAX_ELEMENT_DEPTH) {
-            SetError(XML_ELEMENT_DEPTH_EXCEEDED, _parseCurLineNum, "Element nesting is too deep." );
+        if ( _writer ) {
+            _result = _writer->Join();
+            delete _writer;
+            _writer = 0;
         }
+        return _result;
     }
+#endif
 
-    /**
-     * Function: PopDepth - decrease the depth by 1
+    /*
+     * Snapshot image layout, all in native byte order:
+     *
+     *      SnapshotHeader
+     *      SnapshotNode[nodeCount]             pre-order; parents precede children
+     *      SnapshotAttribute[attributeCount]   grouped per element, in order
+     *      char strings[stringBytes]           normalized, null terminated
+     *
+     * Strings are referenced by offset into the string table, nodes by
+     * index into the node table, so the image holds no pointers.
+     * Bump SNAPSHOT_VERSION if any of the records change.
      */
-    void XMLDocument::PopDepth()
-    {
-        TIXMLASSERT(_parsingDepth > 0);
-        --_parsingDepth;
-    }
+    static const char SNAPSHOT_MAGIC[8] = { 'T', 'X', 'M', 'L', '2', 'S', 'N', 'P' };
+    static const uint32_t SNAPSHOT_VERSION = 1;
+    static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+    static const uint32_t SNAPSHOT_NO_PARENT = 0xffffffff;
+
+    enum {
+        SNAPSHOT_HAS_BOM = 0x01
+    };
+
+    enum {
+        SNAPSHOT_ELEMENT = 1,
+        SNAPSHOT_TEXT,
+        SNAPSHOT_COMMENT,
+        SNAPSHOT_DECLARATION,
+        SNAPSHOT_UNKNOWN
+    };
+
+    enum {
+        SNAPSHOT_CDATA = 0x01,          // text node
+        SNAPSHOT_CLOSED = 0x02          // element was parsed as <foo/>
+    };
+
+    struct SnapshotHeader {
+        char     magic[8];
+        uint32_t byteOrder;
+        uint32_t version;
+        uint32_t flags;
+        uint32_t nodeCount;
+        uint32_t attributeCount;
+        uint32_t reserved;
+        uint64_t stringBytes;
+    };
+
+    struct SnapshotNode {
+        uint64_t value;
+        uint64_t valueLength;
+        uint32_t parent;
+        uint32_t firstAttribute;
+        uint32_t attributeCount;
+        int32_t  lineNum;
+        uint8_t  type;
+        uint8_t  flags;
+        uint8_t  reserved[6];
+    };
+
+    struct SnapshotAttribute {
+        uint64_t name;
+        uint64_t nameLength;
+        uint64_t value;
+        uint64_t valueLength;
+        int32_t  lineNum;
+        uint32_t reserved;
+    };
 
     /*
-     * Constructor
+     * Function: NextInPreOrder - step a depth first walk of the children of 'root'
      */
-    XMLPrinter::XMLPrinter( FILE* file, bool compact, int depth ) :
-            _elementJustOpened( false ),
-            _stack(),
-            _firstElement( true ),
-            _fp( file ),
-            _depth( depth ),
-            _textDepth( -1 ),
-            _processEntities( true ),
-            _compactMode( compact ),
-            _buffer()
+    static const XMLNode* NextInPreOrder( const XMLNode* node, const XMLNode* root )
     {
-        for( int i=0; i<ENTITY_RANGE; ++i ) {
-            _entityFlag[i] = false;
-            _restrictedEntityFlag[i] = false;
+        if ( node->FirstChild() ) {
+            return node->FirstChild();
         }
-        for( int i=0; i<NUM_ENTITIES; ++i ) {
-            const char entityValue = entities[i].value;
-            const unsigned char flagIndex = static_cast<unsigned char>(entityValue);
-            TIXMLASSERT( flagIndex < ENTITY_RANGE );
-            _entityFlag[flagIndex] = true;
+        while ( node != root ) {
+            if ( node->NextSibling() ) {
+                return node->NextSibling();
+            }
+            node = node->Parent();
         }
-        _restrictedEntityFlag[static_cast<unsigned char>('&')] = true;
-        _restrictedEntityFlag[static_cast<unsigned char>('<')] = true;
-        _restrictedEntityFlag[static_cast<unsigned char>('>')] = true;	// not required, but consistency is nice
-        _buffer.Push( 0 );
+        return 0;
     }
 
-    /**
-     * Function: Print - print based on va_list format
-     * @param format
-     * @param ...
+    /*
+     * Function: WriteSnapshot - write 'size' bytes; false on a short write
      */
-    void XMLPrinter::Print( const char* format, ... )
+    static bool WriteSnapshot( FILE* fp, const void* data, size_t size )
     {
-        va_list     va;
-        va_start( va, format );
-
-        if ( _fp ) {
-            vfprintf( _fp, format, va );
-        }
-        else {
-            const int len = TIXML_VSCPRINTF( format, va );
-            // Close out and re-start the va-args
-            va_end( va );
-            TIXMLASSERT( len >= 0 );
-            va_start( va, format );
-            TIXMLASSERT( _buffer.Size() > 0 && _buffer[_buffer.Size() - 1] == 0 );
-            char* p = _buffer.PushArr( len ) - 1;	// back up over the null terminator.
-            TIXML_VSNPRINTF( p, len+1, format, va );
-        }
-        va_end( va );
+        return fwrite( data, 1, size, fp ) == size;
     }
 
     /**
-     * Function: Write - write 'data' to the printer file
-     * @param data
-     * @param size
+     * Function: SaveSnapshot - open the file that will contain the snapshot
+     * @param filename
+     * @return
      */
-    void XMLPrinter::Write( const char* data, size_t size )
+    XMLError XMLDocument::SaveSnapshot( const char* filename )
     {
-        if ( _fp ) {
-            fwrite ( data , sizeof(char), size, _fp);
-        }
-        else {
-            char* p = _buffer.PushArr( static_cast<int>(size) ) - 1;   // back up over the null terminator.
-            memcpy( p, data, size );
-            p[size] = 0;
+        if ( !filename ) {
+            TIXMLASSERT( false );
+            SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+            return _errorID;
         }
-    }
 
-    /**
-     * Function: Putc - write 'ch' to the printer file
-     * @param ch
-     */
-    void XMLPrinter::Putc( char ch )
-    {
-        if ( _fp ) {
-            fputc ( ch, _fp);
+        FILE* fp = callfopen( filename, "wb" );
+        if ( !fp ) {
+            SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
+            return _errorID;
         }
-        else {
-            char* p = _buffer.PushArr( sizeof(char) ) - 1;   // back up over the null terminator.
-            p[0] = ch;
-            p[1] = 0;
+        SaveSnapshot( fp );
+        if ( fclose( fp ) != 0 || _errorID == XML_ERROR_FILE_WRITE_ERROR ) {
+            SetError( XML_ERROR_FILE_WRITE_ERROR, 0, "filename=%s", filename );
         }
+        return _errorID;
     }
 
     /**
-     * Function: PrintSpace - frint spaces as much as 'depth'
-     * @param depth
+     * Function: SaveSnapshot - write the header, the node and attribute tables and the strings
+     * @param fp
+     * @return
      */
-    void XMLPrinter::PrintSpace( int depth )
+    XMLError XMLDocument::SaveSnapshot( FILE* fp )
     {
-        for( int i=0; i<depth; ++i ) {
-            Write( "    " );
+        ClearError();
+
+        // First pass sizes the tables, so that every record can be
+        // written with its final string offset in the second pass.
+        uint64_t nodeCount = 0;
+        uint64_t attributeCount = 0;
+        uint64_t stringBytes = 0;
+        for( const XMLNode* node = FirstChild(); node; node = NextInPreOrder( node, this ) ) {
+            ++nodeCount;
+            stringBytes += strlen( node->Value() ) + 1;
+            const XMLElement* ele = node->ToElement();
+            if ( ele ) {
+                for( const XMLAttribute* a = ele->FirstAttribute(); a; a = a->Next() ) {
+                    ++attributeCount;
+                    stringBytes += strlen( a->Name() ) + strlen( a->Value() ) + 2;
+                }
+            }
+        }
+        if ( nodeCount >= SNAPSHOT_NO_PARENT || attributeCount >= SNAPSHOT_NO_PARENT ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: too many nodes" );
+            return _errorID;
         }
-    }
 
-    /**
-     * Function: PrintString - write a string to the printer file
-     * @param p
-     * @param restricted
-     */
-    void XMLPrinter::PrintString( const char* p, bool restricted )
-    {
-        // Look for runs of bytes between entities to print.
-        const char* q = p;
+        SnapshotHeader header;
+        memset( &header, 0, sizeof( header ) );
+        memcpy( header.magic, SNAPSHOT_MAGIC, sizeof( header.magic ) );
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.version = SNAPSHOT_VERSION;
+        header.flags = _writeBOM ? SNAPSHOT_HAS_BOM : 0;
+        header.nodeCount = static_cast<uint32_t>( nodeCount );
+        header.attributeCount = static_cast<uint32_t>( attributeCount );
+        header.stringBytes = stringBytes;
+        bool ok = WriteSnapshot( fp, &header, sizeof( header ) );
+
+        // Node table. 'parents' holds the index of every open ancestor.
+        DynArray< uint32_t, 32 > parents;
+        uint64_t stringOffset = 0;
+        uint32_t index = 0;
+        uint32_t attributeIndex = 0;
+        const XMLNode* node = FirstChild();
+        while ( node ) {
+            SnapshotNode record;
+            memset( &record, 0, sizeof( record ) );
+            record.valueLength = strlen( node->Value() );
+            record.value = stringOffset;
+            stringOffset += record.valueLength + 1;
+            record.parent = parents.Empty() ? SNAPSHOT_NO_PARENT : parents.PeekTop();
+            record.lineNum = node->GetLineNum();
+
+            if ( const XMLElement* ele = node->ToElement() ) {
+                record.type = SNAPSHOT_ELEMENT;
+                record.flags = ( ele->ClosingType() == XMLElement::CLOSED ) ? SNAPSHOT_CLOSED : 0;
+                record.firstAttribute = attributeIndex;
+                for( const XMLAttribute* a = ele->FirstAttribute(); a; a = a->Next() ) {
+                    ++record.attributeCount;
+                    stringOffset += strlen( a->Name() ) + strlen( a->Value() ) + 2;
+                }
+                attributeIndex += record.attributeCount;
+            }
+            else if ( const XMLText* text = node->ToText() ) {
+                record.type = SNAPSHOT_TEXT;
+                record.flags = text->CData() ? SNAPSHOT_CDATA : 0;
+            }
+            else if ( node->ToComment() ) {
+                record.type = SNAPSHOT_COMMENT;
+            }
+            else if ( node->ToDeclaration() ) {
+                record.type = SNAPSHOT_DECLARATION;
+            }
+            else {
+                TIXMLASSERT( node->ToUnknown() );
+                record.type = SNAPSHOT_UNKNOWN;
+            }
+            ok = ok && WriteSnapshot( fp, &record, sizeof( record ) );
 
-        if ( _processEntities ) {
-            const bool* flag = restricted ? _restrictedEntityFlag : _entityFlag;
-            while ( *q ) {
-                TIXMLASSERT( p <= q );
-                // Remember, char is sometimes signed. (How many times has that bitten me?)
-                if ( *q > 0 && *q < ENTITY_RANGE ) {
-                    // Check for entities. If one is found, flush
-                    // the stream up until the entity, write the
-                    // entity, and keep looking.
-                    if ( flag[static_cast<unsigned char>(*q)] ) {
-                        while ( p < q ) {
-                            const size_t delta = q - p;
-                            const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
-                            Write( p, toPrint );
-                            p += toPrint;
-                        }
-                        bool entityPatternPrinted = false;
-                        for( int i=0; i<NUM_ENTITIES; ++i ) {
-                            if ( entities[i].value == *q ) {
-                                Putc( '&' );
-                                Write( entities[i].pattern, entities[i].length );
-                                Putc( ';' );
-                                entityPatternPrinted = true;
-                                break;
-                            }
-                        }
-                        if ( !entityPatternPrinted ) {
-                            // TIXMLASSERT( entityPatternPrinted ) causes gcc -Wunused-but-set-variable in release
-                            TIXMLASSERT( false );
-                        }
-                        ++p;
+            if ( node->FirstChild() ) {
+                parents.Push( index );
+                node = node->FirstChild();
+            }
+            else {
+                while ( node != this && !node->NextSibling() ) {
+                    node = node->Parent();
+                    if ( node != this ) {
+                        parents.Pop();
                     }
                 }
-                ++q;
-                TIXMLASSERT( p <= q );
+                node = ( node == this ) ? 0 : node->NextSibling();
             }
-            // Flush the remaining string. This will be the entire
-            // string if an entity wasn't found.
-            if ( p < q ) {
-                const size_t delta = q - p;
-                const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
-                Write( p, toPrint );
+            ++index;
+        }
+
+        // Attribute table; the strings follow each node's value, in the
+        // order the node table assigned them.
+        stringOffset = 0;
+        for( node = FirstChild(); node; node = NextInPreOrder( node, this ) ) {
+            stringOffset += strlen( node->Value() ) + 1;
+            const XMLElement* ele = node->ToElement();
+            if ( !ele ) {
+                continue;
+            }
+            for( const XMLAttribute* a = ele->FirstAttribute(); a; a = a->Next() ) {
+                SnapshotAttribute record;
+                memset( &record, 0, sizeof( record ) );
+                record.nameLength = strlen( a->Name() );
+                record.name = stringOffset;
+                stringOffset += record.nameLength + 1;
+                record.valueLength = strlen( a->Value() );
+                record.value = stringOffset;
+                stringOffset += record.valueLength + 1;
+                record.lineNum = a->GetLineNum();
+                ok = ok && WriteSnapshot( fp, &record, sizeof( record ) );
             }
         }
-        else {
-            Write( p );
+        TIXMLASSERT( stringOffset == stringBytes );
+
+        // String table.
+        for( node = FirstChild(); node; node = NextInPreOrder( node, this ) ) {
+            ok = ok && WriteSnapshot( fp, node->Value(), strlen( node->Value() ) + 1 );
+            const XMLElement* ele = node->ToElement();
+            if ( ele ) {
+                for( const XMLAttribute* a = ele->FirstAttribute(); a; a = a->Next() ) {
+                    ok = ok && WriteSnapshot( fp, a->Name(), strlen( a->Name() ) + 1 );
+                    ok = ok && WriteSnapshot( fp, a->Value(), strlen( a->Value() ) + 1 );
+                }
+            }
         }
+        // A full disk may only show when the buffered tail is written.
+        if ( !ok || fflush( fp ) != 0 ) {
+            SetError( XML_ERROR_FILE_WRITE_ERROR, 0, 0 );
+        }
+        return _errorID;
     }
 
     /**
-     * Function: PushHeader - write BOB or Decleration
-     * @param writeBOM
-     * @param writeDec
+     * Function: LoadSnapshot - read a snapshot file into memory and load it
+     * @param filename
+     * @return
      */
-    void XMLPrinter::PushHeader( bool writeBOM, bool writeDec )
+    XMLError XMLDocument::LoadSnapshot( const char* filename )
     {
-        if ( writeBOM ) {
-            static const unsigned char bom[] = { TIXML_UTF_LEAD_0, TIXML_UTF_LEAD_1, TIXML_UTF_LEAD_2, 0 };
-            Write( reinterpret_cast< const char* >( bom ) );
+        if ( !filename ) {
+            TIXMLASSERT( false );
+            SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+            return _errorID;
         }
-        if ( writeDec ) {
-            PushDeclaration( "xml version=\"1.0\"" );
+
+        Clear();
+        FILE* fp = callfopen( filename, "rb" );
+        if ( !fp ) {
+            SetError( XML_ERROR_FILE_NOT_FOUND, 0, "filename=%s", filename );
+            return _errorID;
+        }
+        TIXML_FSEEK( fp, 0, SEEK_END );
+        const long long length = TIXML_FTELL( fp );
+        TIXML_FSEEK( fp, 0, SEEK_SET );
+        if ( length <= 0 || static_cast<unsigned long long>(length) >= static_cast<unsigned long long>(static_cast<size_t>(-1)) ) {
+            fclose( fp );
+            SetError( length == 0 ? XML_ERROR_EMPTY_DOCUMENT : XML_ERROR_FILE_READ_ERROR, 0, "filename=%s", filename );
+            return _errorID;
+        }
+
+        const size_t size = static_cast<size_t>(length);
+        char* image = static_cast<char*>( _allocator->Allocate( size ) );
+        const size_t read = fread( image, 1, size, fp );
+        fclose( fp );
+        if ( read != size ) {
+            _allocator->Deallocate( image, size );
+            SetError( XML_ERROR_FILE_READ_ERROR, 0, "filename=%s", filename );
+            return _errorID;
         }
+        LoadSnapshot( image, size );
+        _allocator->Deallocate( image, size );
+        return _errorID;
     }
 
     /**
-     * Function: PrepareForNewNode - create new line and idente once for prepering printing the next node
-     * @param compactMode
+     * Function: LoadSnapshot - validate an image and rebuild the DOM from its tables
+     * @param image
+     * @param size
+     * @return
      */
-    void XMLPrinter::PrepareForNewNode( bool compactMode )
+    XMLError XMLDocument::LoadSnapshot( const void* image, size_t size )
     {
-        SealElementIfJustOpened();
+        Clear();
 
-        if ( compactMode ) {
-            return;
+        const char* mem = static_cast<const char*>( image );
+        SnapshotHeader header;
+        if ( !mem || size < sizeof( header ) ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: truncated header" );
+            return _errorID;
+        }
+        // The image may not be aligned for the records; copy them out.
+        memcpy( &header, mem, sizeof( header ) );
+        if ( memcmp( header.magic, SNAPSHOT_MAGIC, sizeof( header.magic ) ) != 0 ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: not a snapshot" );
+            return _errorID;
+        }
+        if ( header.byteOrder != SNAPSHOT_BYTE_ORDER ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: wrong byte order" );
+            return _errorID;
+        }
+        if ( header.version != SNAPSHOT_VERSION ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: version=%u", header.version );
+            return _errorID;
+        }
+        const uint64_t tableBytes = uint64_t( header.nodeCount ) * sizeof( SnapshotNode )
+                                    + uint64_t( header.attributeCount ) * sizeof( SnapshotAttribute );
+        const uint64_t bodyBytes = size - sizeof( header );
+        if ( tableBytes > bodyBytes || bodyBytes - tableBytes != header.stringBytes ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: size mismatch" );
+            return _errorID;
+        }
+        if ( header.nodeCount == 0 ) {
+            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+            return _errorID;
+        }
+        const char* nodeTable = mem + sizeof( header );
+        const char* attributeTable = nodeTable + uint64_t( header.nodeCount ) * sizeof( SnapshotNode );
+        const char* strings = nodeTable + tableBytes;
+        const uint64_t stringBytes = header.stringBytes;
+        if ( stringBytes == 0 || strings[stringBytes - 1] != 0 ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: bad string table" );
+            return _errorID;
         }
 
-        if ( _firstElement ) {
-            PrintSpace (_depth);
-        } else if ( _textDepth < 0) {
-            Putc( '\n' );
-            PrintSpace( _depth );
+        TIXMLASSERT( _charBuffer == 0 );
+        AllocCharBuffer( static_cast<size_t>( stringBytes ) );
+        memcpy( _charBuffer, strings, static_cast<size_t>( stringBytes ) );
+        _writeBOM = ( header.flags & SNAPSHOT_HAS_BOM ) != 0;
+        _parseLineNum = 1;
+
+        DynArray< XMLNode*, 32 > nodes;
+        const char* reason = 0;
+        for( uint32_t i = 0; i < header.nodeCount && !reason; ++i ) {
+            SnapshotNode record;
+            memcpy( &record, nodeTable + uint64_t( i ) * sizeof( record ), sizeof( record ) );
+
+            XMLNode* parent = this;
+            if ( record.parent != SNAPSHOT_NO_PARENT ) {
+                if ( record.parent >= i || !nodes[record.parent]->ToElement() ) {
+                    reason = "bad parent";
+                    break;
+                }
+                parent = nodes[record.parent];
+            }
+            if ( record.value >= stringBytes || record.valueLength >= stringBytes - record.value
+                    || _charBuffer[record.value + record.valueLength] != 0 ) {
+                reason = "bad string offset";
+                break;
+            }
+            if ( record.type != SNAPSHOT_ELEMENT && record.attributeCount != 0 ) {
+                reason = "attributes on a non-element";
+                break;
+            }
+            if ( uint64_t( record.firstAttribute ) + record.attributeCount > header.attributeCount ) {
+                reason = "bad attribute range";
+                break;
+            }
+
+            XMLNode* node = 0;
+            switch ( record.type ) {
+                case SNAPSHOT_ELEMENT:
+                {
+                    XMLElement* ele = CreateUnlinkedNode<XMLElement>( _elementPool );
+                    ele->_closingType = ( record.flags & SNAPSHOT_CLOSED ) ? XMLElement::CLOSED : XMLElement::OPEN;
+                    XMLAttribute* prevAttribute = 0;
+                    for( uint32_t a = 0; a < record.attributeCount; ++a ) {
+                        SnapshotAttribute attrRecord;
+                        memcpy( &attrRecord, attributeTable + ( uint64_t( record.firstAttribute ) + a ) * sizeof( attrRecord ), sizeof( attrRecord ) );
+                        if ( attrRecord.name >= stringBytes || attrRecord.nameLength >= stringBytes - attrRecord.name
+                                || attrRecord.value >= stringBytes || attrRecord.valueLength >= stringBytes - attrRecord.value
+                                || _charBuffer[attrRecord.name + attrRecord.nameLength] != 0
+                                || _charBuffer[attrRecord.value + attrRecord.valueLength] != 0 ) {
+                            reason = "bad attribute string offset";
+                            break;
+                        }
+                        XMLAttribute* attrib = ele->CreateAttribute();
+                        char* name = _charBuffer + attrRecord.name;
+                        char* value = _charBuffer + attrRecord.value;
+                        attrib->_name.Set( name, name + attrRecord.nameLength, 0 );
+                        attrib->_value.Set( value, value + attrRecord.valueLength, 0 );
+                        attrib->_parseLineNum = attrRecord.lineNum;
+                        if ( prevAttribute ) {
+                            prevAttribute->_next = attrib;
+                        }
+                        else {
+                            ele->_rootAttribute = attrib;
+                        }
+                        prevAttribute = attrib;
+                    }
+                    node = ele;
+                    break;
+                }
+                case SNAPSHOT_TEXT:
+                {
+                    XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
+                    text->SetCData( ( record.flags & SNAPSHOT_CDATA ) != 0 );
+                    node = text;
+                    break;
+                }
+                case SNAPSHOT_COMMENT:
+                    node = CreateUnlinkedNode<XMLComment>( _commentPool );
+                    break;
+                case SNAPSHOT_DECLARATION:
+                    node = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
+                    break;
+                case SNAPSHOT_UNKNOWN:
+                    node = CreateUnlinkedNode<XMLUnknown>( _commentPool );
+                    break;
+                default:
+                    reason = "bad node type";
+                    break;
+            }
+            if ( !node ) {
+                break;
+            }
+            char* value = _charBuffer + record.value;
+            node->_value.Set( value, value + record.valueLength, 0 );
+            node->_parseLineNum = record.lineNum;
+            if ( reason ) {
+                DeleteNode( node );
+                break;
+            }
+            parent->InsertEndChild( node );
+            nodes.Push( node );
         }
 
-        _firstElement = false;
+        if ( reason ) {
+            SetError( XML_ERROR_PARSING, 0, "snapshot: %s", reason );
+            // Same clean up as a failed Parse().
+            DeleteChildren();
+            _elementPool.Clear();
+            _attributePool.Clear();
+            _textPool.Clear();
+            _commentPool.Clear();
+        }
+        return _errorID;
     }
 
     /**
-     * Function: OpenElement - print  <'name'
-     * @param name
-     * @param compactMode
+     * Function: Parse - envelope parsing - first validation
+     * @param p
+     * @param len
+     * @return
      */
-    void XMLPrinter::OpenElement( const char* name, bool compactMode )
+    XMLError XMLDocument::Parse( const char* p, size_t len )
     {
-        PrepareForNewNode( compactMode );
-        _stack.Push( name );
+        Clear();
 
-        Write ( "<" );
-        Write ( name );
+        if ( len == 0 || !p || !*p ) {
+            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+            return _errorID;
+        }
+        if ( len == static_cast<size_t>(-1) ) {
+            len = strlen( p );
+        }
+        TIXMLASSERT( _charBuffer == 0 );
+        AllocCharBuffer( len+1 );
+        memcpy( _charBuffer, p, len );
+        _charBuffer[len] = 0;
 
-        _elementJustOpened = true;
-        ++_depth;
+        Parse();
+        if ( Error() ) {
+            // clean up now essentially dangling memory.
+            // and the parse fail can put objects in the
+            // pools that are dead and inaccessible.
+            DeleteChildren();
+            _elementPool.Clear();
+            _attributePool.Clear();
+            _textPool.Clear();
+            _commentPool.Clear();
+        }
+        return _errorID;
     }
 
     /**
-     * Function: PushAttribute - print attribute to the file with string value
-     * @param name
-     * @param value
+     * Function: Print - print the documents
+     * @param streamer
      */
-    void XMLPrinter::PushAttribute( const char* name, const char* value )
+    void XMLDocument::Print( XMLPrinter* streamer ) const
     {
-        TIXMLASSERT( _elementJustOpened );
-        Putc ( ' ' );
-        Write( name );
-        Write( "=\"" );
-        PrintString( value, false );
-        Putc ( '\"' );
+        if ( streamer ) {
+            Accept( streamer );
+        }
+        else {
+            XMLPrinter stdoutStreamer( stdout );
+            Accept( &stdoutStreamer );
+        }
     }
 
     /**
-     * PushAttribute - print attribute to the file with int value
-     * @param name
-     * @param v
+     * Function: SerializedSize - bytes Print() would write, counted without writing them
+     * @param compact
+     * @return
      */
-    void XMLPrinter::PushAttribute( const char* name, int v )
+    size_t XMLDocument::SerializedSize( bool compact ) const
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( v, buf, BUF_SIZE );
-        PushAttribute( name, buf );
+        XMLPrinter counter( 0, compact );
+        counter._outputMode = XMLPrinter::OUTPUT_COUNT;
+        Accept( &counter );
+        return counter._counted;
     }
 
-
-    void XMLPrinter::PushAttribute( const char* name, unsigned v )
+    /**
+     * Function: SetError - log error
+     * @param error
+     * @param lineNum
+     * @param format
+     * @param ...
+     */
+    void XMLDocument::SetError( XMLError error, int lineNum, const char* format, ... )
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( v, buf, BUF_SIZE );
-        PushAttribute( name, buf );
-    }
+        TIXMLASSERT( error >= 0 && error < XML_ERROR_COUNT );
+        _errorID = error;
+        _errorLineNum = lineNum;
+        _errorStr.Reset();
 
+        const size_t BUFFER_SIZE = 1000;
+        char buffer[BUFFER_SIZE];
 
-    void XMLPrinter::PushAttribute(const char* name, int64_t v)
-    {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr(v, buf, BUF_SIZE);
-        PushAttribute(name, buf);
-    }
+        TIXMLASSERT(sizeof(error) <= sizeof(int));
+        TIXML_SNPRINTF(buffer, BUFFER_SIZE, "Error=%s ErrorID=%d (0x%x) Line number=%d", ErrorIDToName(error), int(error), int(error), lineNum);
 
+        if (format) {
+            size_t len = strlen(buffer);
+            TIXML_SNPRINTF(buffer + len, BUFFER_SIZE - len, ": ");
+            len = strlen(buffer);
 
-    void XMLPrinter::PushAttribute(const char* name, uint64_t v)
-    {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr(v, buf, BUF_SIZE);
-        PushAttribute(name, buf);
+            va_list va;
+            va_start(va, format);
+            TIXML_VSNPRINTF(buffer + len, BUFFER_SIZE - len, format, va);
+            va_end(va);
+        }
+        _errorStr.SetStr( buffer, 0, _allocator );
     }
 
-
-    void XMLPrinter::PushAttribute( const char* name, bool v )
+    /**
+     * Function: ErrorIDToName - convert error id to name
+     * @param errorID
+     * @return
+     */
+/*static*/ const char* XMLDocument::ErrorIDToName(XMLError errorID)
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( v, buf, BUF_SIZE );
-        PushAttribute( name, buf );
+        TIXMLASSERT( errorID >= 0 && errorID < XML_ERROR_COUNT );
+        const char* errorName = _errorNames[errorID];
+        TIXMLASSERT( errorName && errorName[0] );
+        return errorName;
     }
 
-
-    void XMLPrinter::PushAttribute( const char* name, double v )
+    /**
+     * Function: ErrorStr = returns error string
+     * @return
+     */
+    const char* XMLDocument::ErrorStr() const
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( v, buf, BUF_SIZE );
-        PushAttribute( name, buf );
+        if ( _errorStr.Empty() && _errorID == XML_SUCCESS ) {
+            // What SetError( XML_SUCCESS, 0, 0 ) would format. A constant,
+            // so reading a shared document writes nothing.
+            return "Error=XML_SUCCESS ErrorID=0 (0x0) Line number=0";
+        }
+        return _errorStr.Empty() ? "" : _errorStr.GetStr();
     }
 
     /**
-     * Function: CloseElement - print element clouser
-     * @param compactMode
+     * Function: PrintError
      */
-    void XMLPrinter::CloseElement( bool compactMode )
+    void XMLDocument::PrintError() const
     {
-        --_depth;
-        const char* name = _stack.Pop();
-
-        if ( _elementJustOpened ) {
-            Write( "/>" );
-        }
-        else {
-            if ( _textDepth < 0 && !compactMode) {
-                Putc( '\n' );
-                PrintSpace( _depth );
-            }
-            Write ( "</" );
-            Write ( name );
-            Write ( ">" );
-        }
+        printf("%s\n", ErrorStr());
+    }
 
-        if ( _textDepth == _depth ) {
-            _textDepth = -1;
-        }
-        if ( _depth == 0 && !compactMode) {
-            Putc( '\n' );
-        }
-        _elementJustOpened = false;
+    /**
+     * Function: ErrorName - return the text error value based on error id
+     * @return
+     */
+    const char* XMLDocument::ErrorName() const
+    {
+        return ErrorIDToName(_errorID);
     }
 
     /**
-     * Function: SealElementIfJustOpened - clouse open element with '>'
+     * Function: Parse - parsing envelope - step 2 - start the recursive methos ParseDeep
      */
-    void XMLPrinter::SealElementIfJustOpened()
+    void XMLDocument::Parse()
     {
-        if ( !_elementJustOpened ) {
+        TIXMLASSERT( NoChildren() ); // Clear() must have been called previously
+        TIXMLASSERT( _charBuffer );
+        _parseCurLineNum = 1;
+        _parseLineNum = 1;
+        char* p = _charBuffer;
+        p = XMLUtil::SkipWhiteSpace( p, &_parseCurLineNum );
+        p = const_cast<char*>( XMLUtil::ReadBOM( p, &_writeBOM ) );
+        if ( !*p ) {
+            SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
             return;
         }
-        _elementJustOpened = false;
-        Putc( '>' );
+        ParseDeep(p, 0, &_parseCurLineNum );
     }
 
     /**
-     * Function: PushText - print 'text' to file. may be CDATA
-     * @param text
-     * @param cdata
+     * Function: PushDepth - increase the depth of the document by one - checking that no over the MAX
      */
-    void XMLPrinter::PushText( const char* text, bool cdata )
+    void XMLDocument::PushDepth()
     {
-        _textDepth = _depth-1;
-
-        SealElementIfJustOpened();
-        if ( cdata ) {
-            Write( "<![CDATA[" );
-            Write( text );
-            Write( "]]>" );
-        }
-        else {
-            PrintString( text, true );
+        _parsingDepth++;
+        if (_parsingDepth == TINYXML2_MAX_ELEMENT_DEPTH) {
+            SetError(XML_ELEMENT_DEPTH_EXCEEDED, _parseCurLineNum, "Element nesting is too deep." );
         }
     }
 
-
-    void XMLPrinter::PushText( int64_t value )
+    /**
+     * Function: PopDepth - decrease the depth by 1
+     */
+    void XMLDocument::PopDepth()
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        TIXMLASSERT(_parsingDepth > 0);
+        --_parsingDepth;
     }
 
+#ifdef TINYXML2_HAS_THREADS
+    /*
+     * Identifies a pool to the thread caches. The pool and every cache slot
+     * holding it count a reference; 'alive' goes false when the pool is
+     * destroyed, and the slots then free its documents.
+     */
+    struct XMLDocumentPool::CacheKey {
+        std::atomic<int>    refs;
+        std::atomic<bool>   alive;
 
-    void XMLPrinter::PushText( uint64_t value )
+        CacheKey() : refs( 1 ), alive( true ) {}
+
+        void Release() {
+            if ( --refs == 0 ) {
+                delete this;
+            }
+        }
+    };
+
+    /*
+     * Per thread cache of pooled documents. A thread serves a few pools at
+     * once; each slot belongs to one pool while it holds documents, and is
+     * emptied as soon as that pool is found destroyed.
+     */
+    struct DocumentPoolCache {
+        struct Slot {
+            XMLDocumentPool::CacheKey*  key;
+            int                         count;
+            XMLDocument*                docs[XMLDocumentPool::LOCAL_CACHE_SIZE];
+
+            void Reset() {
+                while ( count ) {
+                    delete docs[--count];
+                }
+                if ( key ) {
+                    key->Release();
+                    key = 0;
+                }
+            }
+        };
+        enum { SLOTS = 4 };
+        Slot slots[SLOTS];
+
+        DocumentPoolCache() {
+            memset( slots, 0, sizeof( slots ) );
+        }
+        ~DocumentPoolCache() {
+            for( int i = 0; i < SLOTS; ++i ) {
+                slots[i].Reset();
+            }
+        }
+
+        // The slot of 'key'; with 'claim', an empty slot if it has none.
+        Slot* Find( XMLDocumentPool::CacheKey* key, bool claim ) {
+            Slot* empty = 0;
+            for( int i = 0; i < SLOTS; ++i ) {
+                Slot& slot = slots[i];
+                if ( slot.key == key ) {
+                    return &slot;
+                }
+                if ( slot.key && !slot.key->alive ) {
+                    slot.Reset();
+                }
+                if ( !empty && slot.count == 0 ) {
+                    empty = &slot;
+                }
+            }
+            if ( claim && empty ) {
+                if ( empty->key ) {
+                    empty->key->Release();
+                }
+                ++key->refs;
+                empty->key = key;
+                return empty;
+            }
+            return 0;
+        }
+    };
+
+    static thread_local DocumentPoolCache gDocumentPoolCache;
+
+    /*
+     * Constructor
+     */
+    XMLDocumentPool::XMLDocumentPool( size_t maxSpill, bool processEntities, Whitespace whitespaceMode ) :
+            _key( new CacheKey() ),
+            _maxSpill( maxSpill ),
+            _processEntities( processEntities ),
+            _whitespaceMode( whitespaceMode ),
+            _spillMutex(),
+            _spill()
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr(value, buf, BUF_SIZE);
-        PushText(buf, false);
     }
 
-
-    void XMLPrinter::PushText( int value )
+    /*
+     * Destructor - documents cached by other threads are freed when those
+     * threads next use a pool, or exit
+     */
+    XMLDocumentPool::~XMLDocumentPool()
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        DocumentPoolCache::Slot* slot = gDocumentPoolCache.Find( _key, false );
+        if ( slot ) {
+            slot->Reset();
+        }
+        _key->alive = false;
+        _key->Release();
+        while ( !_spill.Empty() ) {
+            delete _spill.Pop();
+        }
     }
 
+    /**
+     * Function: Acquire - hand out a cleared document
+     * @return
+     */
+    XMLDocumentPool::Handle XMLDocumentPool::Acquire()
+    {
+        return Handle( this, Take() );
+    }
 
-    void XMLPrinter::PushText( unsigned value )
+    /**
+     * Function: SpillSize - number of documents in the shared list
+     * @return
+     */
+    size_t XMLDocumentPool::SpillSize() const
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        std::lock_guard<std::mutex> lock( _spillMutex );
+        return static_cast<size_t>( _spill.Size() );
     }
 
+    /**
+     * Function: Take - thread cache, then the spill list, then a new document
+     * @return
+     */
+    XMLDocument* XMLDocumentPool::Take()
+    {
+        DocumentPoolCache::Slot* slot = gDocumentPoolCache.Find( _key, false );
+        if ( slot && slot->count ) {
+            return slot->docs[--slot->count];
+        }
+        {
+            std::lock_guard<std::mutex> lock( _spillMutex );
+            if ( !_spill.Empty() ) {
+                return _spill.Pop();
+            }
+        }
+        XMLDocument* doc = new XMLDocument( _processEntities, _whitespaceMode );
+        doc->SetReuseMode( true );
+        return doc;
+    }
 
-    void XMLPrinter::PushText( bool value )
+    /**
+     * Function: Give - clear 'doc' and keep it in the thread cache, the spill list, or delete it
+     * @param doc
+     */
+    void XMLDocumentPool::Give( XMLDocument* doc )
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        TIXMLASSERT( doc );
+        doc->Clear();
+        DocumentPoolCache::Slot* slot = gDocumentPoolCache.Find( _key, true );
+        if ( slot && slot->count < LOCAL_CACHE_SIZE ) {
+            slot->docs[slot->count++] = doc;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock( _spillMutex );
+            if ( static_cast<size_t>( _spill.Size() ) < _maxSpill ) {
+                _spill.Push( doc );
+                return;
+            }
+        }
+        delete doc;
     }
 
 
-    void XMLPrinter::PushText( float value )
+    XMLPersistentDocument::XMLPersistentDocument( bool processEntities, Whitespace whitespaceMode ) :
+        _writer( processEntities, whitespaceMode ),
+        _retired( 0 ),
+        _spare( 0 ),
+        _published( 0 )
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        _current = 0;
+        _entering = 0;
     }
 
-
-    void XMLPrinter::PushText( double value )
+    XMLPersistentDocument::~XMLPersistentDocument()
     {
-        char buf[BUF_SIZE];
-        XMLUtil::ToStr( value, buf, BUF_SIZE );
-        PushText( buf, false );
+        TIXMLASSERT( _entering == 0 );
+        Snapshot* current = _current.exchange( 0 );
+        if ( current ) {
+            TIXMLASSERT( current->pins == 0 );
+            current->next = _retired;
+            _retired = current;
+        }
+        while ( _retired ) {
+            TIXMLASSERT( _retired->pins == 0 );
+            Snapshot* next = _retired->next;
+            delete _retired;
+            _retired = next;
+        }
+        delete _spare;
     }
 
     /**
-     * Function: PushComment - print 'comment' to the file
-     * @param comment
+     * Function: Publish - bring a spare version up to the writer's document, or copy it, and make it current
+     * @return the number of the version
      */
-    void XMLPrinter::PushComment( const char* comment )
-    {
-        PrepareForNewNode( _compactMode );
+    uint64_t XMLPersistentDocument::Publish()
+    {
+        // Only the paths edited since the last Publish() are hashed again.
+        _writer.Hash();
+        Snapshot* snapshot = _spare;
+        _spare = 0;
+        if ( snapshot ) {
+            // Patch the old version: equal subtrees are skipped by hash. The
+            // strings the script brings in are normalized copies, so hashing
+            // the patched paths finalizes it again.
+            XMLDiff( snapshot->doc, _writer, &_script );
+            const XMLError error = XMLPatch( &snapshot->doc, _script );
+            _script.Clear();
+            if ( error == XML_SUCCESS ) {
+                snapshot->doc.Hash();
+            }
+            else {
+                delete snapshot;
+                snapshot = 0;
+            }
+        }
+        if ( !snapshot ) {
+            // The copy takes the hashes cached in the writer's document, and
+            // shares its strings once they are counted.
+            _writer.FinalizeStrings();
+            snapshot = new Snapshot( _writer.ProcessEntities(), _writer.WhitespaceMode() );
+            _writer.DeepCopy( &snapshot->doc );
+            snapshot->doc.FinalizeStrings();
+        }
+        snapshot->number = ++_published;
 
-        Write( "<!--" );
-        Write( comment );
-        Write( "-->" );
+        Snapshot* old = _current.exchange( snapshot );
+        if ( old ) {
+            old->next = _retired;
+            _retired = old;
+        }
+        Reclaim();
+        return snapshot->number;
     }
 
     /**
-     * Function: PushDeclaration - print 'value' as decleration
-     * @param value
+     * Function: Pin - take and pin the current version
      */
-    void XMLPrinter::PushDeclaration( const char* value )
+    XMLPersistentDocument::Version XMLPersistentDocument::Pin() const
     {
-        PrepareForNewNode( _compactMode );
-
-        Write( "<?" );
-        Write( value );
-        Write( "?>" );
+        ++_entering;
+        Snapshot* snapshot = _current.load();
+        if ( snapshot ) {
+            ++snapshot->pins;
+        }
+        --_entering;
+        return Version( snapshot );
     }
 
     /**
-     * Function: PushUnknown - print 'value' as unkown
-     * @param value
+     * Function: Reclaim - free the retired versions nothing pins, but keep one as the spare
+     * @return the number of retired versions left
      */
-    void XMLPrinter::PushUnknown( const char* value )
+    size_t XMLPersistentDocument::Reclaim()
+    {
+        // A reader that loaded a retired version from _current counts in
+        // _entering until it has pinned it. With no reader there, every
+        // version that is retired and unpinned stays so.
+        const bool quiet = _entering == 0;
+        size_t left = 0;
+        Snapshot** link = &_retired;
+        while ( *link ) {
+            Snapshot* snapshot = *link;
+            if ( quiet && snapshot->pins == 0 ) {
+                *link = snapshot->next;
+                if ( _spare ) {
+                    delete snapshot;
+                }
+                else {
+                    snapshot->next = 0;
+                    _spare = snapshot;
+                }
+            }
+            else {
+                link = &snapshot->next;
+                ++left;
+            }
+        }
+        return left;
+    }
+#endif
+
+    bool XMLOutputSink::WriteV( const XMLOutputChunk* chunks, size_t count )
     {
-        PrepareForNewNode( _compactMode );
+        for( size_t i=0; i<count; ++i ) {
+            if ( !Write( chunks[i].data, chunks[i].size ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        Write( "<!" );
-        Write( value );
-        Putc( '>' );
+
+    bool XMLFileSink::Write( const char* data, size_t size )
+    {
+        return fwrite( data, sizeof(char), size, _fp ) == size;
     }
 
 
-    bool XMLPrinter::VisitEnter( const XMLDocument& doc )
+    bool XMLFileSink::Flush()
     {
-        _processEntities = doc.ProcessEntities();
-        if ( doc.HasBOM() ) {
-            PushHeader( true, false );
+        return fflush( _fp ) == 0;
+    }
+
+
+#ifdef TINYXML2_HAS_POSIX_IO
+    bool XMLFdSink::Write( const char* data, size_t size )
+    {
+        while ( size > 0 ) {
+            const ssize_t written = write( _fd, data, size );
+            if ( written < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>( written );
         }
         return true;
     }
 
 
-    bool XMLPrinter::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
+    bool XMLFdSink::WriteV( const XMLOutputChunk* chunks, size_t count )
     {
-        const XMLElement* parentElem = 0;
-        if ( element.Parent() ) {
-            parentElem = element.Parent()->ToElement();
-        }
-        const bool compactMode = parentElem ? CompactMode( *parentElem ) : _compactMode;
-        OpenElement( element.Name(), compactMode );
-        while ( attribute ) {
-            PushAttribute( attribute->Name(), attribute->Value() );
-            attribute = attribute->Next();
+        enum { MAX_IOV = 16 };
+        while ( count > 0 ) {
+            struct iovec iov[MAX_IOV];
+            const int n = count < MAX_IOV ? static_cast<int>( count ) : MAX_IOV;
+            for( int i=0; i<n; ++i ) {
+                iov[i].iov_base = const_cast<char*>( chunks[i].data );
+                iov[i].iov_len = chunks[i].size;
+            }
+            ssize_t written = writev( _fd, iov, n );
+            if ( written < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                return false;
+            }
+            // Skip the chunks written in full; finish a partial one with Write().
+            int i = 0;
+            while ( i < n && static_cast<size_t>( written ) >= chunks[i].size ) {
+                written -= static_cast<ssize_t>( chunks[i].size );
+                ++i;
+            }
+            if ( i < n ) {
+                if ( !Write( chunks[i].data + written, chunks[i].size - static_cast<size_t>( written ) ) ) {
+                    return false;
+                }
+                ++i;
+            }
+            chunks += i;
+            count -= static_cast<size_t>( i );
         }
         return true;
     }
+#endif
 
 
-    bool XMLPrinter::VisitExit( const XMLElement& element )
+#ifdef TINYXML2_HAS_ZLIB
+    struct XMLGzipSink::Stream {
+        enum { OUT_SIZE = 64 * 1024 };
+        z_stream    z;
+        bool        ok;
+        Bytef       out[OUT_SIZE];
+    };
+
+
+    XMLGzipSink::XMLGzipSink( XMLOutputSink& next, int level ) :
+        _next( &next ),
+        _stream( new Stream ),
+        _pending( false ),
+        _failed( false ),
+        _finished( false )
     {
-        CloseElement( CompactMode(element) );
-        return true;
+        if ( level < -1 || level > 9 ) {
+            level = Z_DEFAULT_COMPRESSION;
+        }
+        memset( &_stream->z, 0, sizeof( _stream->z ) );
+        // windowBits 15 + 16: a gzip header and trailer rather than zlib's.
+        _stream->ok = deflateInit2( &_stream->z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) == Z_OK;
+        _failed = !_stream->ok;
     }
 
 
-    bool XMLPrinter::Visit( const XMLText& text )
+    XMLGzipSink::~XMLGzipSink()
     {
-        PushText( text.Value(), text.CData() );
-        return true;
+        Finish();
+        if ( _stream->ok ) {
+            deflateEnd( &_stream->z );
+        }
+        delete _stream;
     }
 
 
-    bool XMLPrinter::Visit( const XMLComment& comment )
+    bool XMLGzipSink::Deflate( const char* data, size_t size, int flush )
     {
-        PushComment( comment.Value() );
-        return true;
+        z_stream& z = _stream->z;
+        z.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( data ) );
+        for( ;; ) {
+            // avail_in is a uInt; feed very large writes in pieces.
+            static const size_t MAX_IN = 1024 * 1024 * 1024;
+            const size_t in = size < MAX_IN ? size : MAX_IN;
+            z.avail_in = static_cast<uInt>( in );
+            size -= in;
+            const int pieceFlush = size > 0 ? Z_NO_FLUSH : flush;
+            do {
+                z.next_out = _stream->out;
+                z.avail_out = Stream::OUT_SIZE;
+                if ( deflate( &z, pieceFlush ) == Z_STREAM_ERROR ) {
+                    return false;
+                }
+                const size_t have = Stream::OUT_SIZE - z.avail_out;
+                if ( have > 0 && !_next->Write( reinterpret_cast<const char*>( _stream->out ), have ) ) {
+                    return false;
+                }
+            } while ( z.avail_out == 0 );
+            TIXMLASSERT( z.avail_in == 0 );
+            if ( size == 0 ) {
+                return true;
+            }
+        }
     }
 
-    bool XMLPrinter::Visit( const XMLDeclaration& declaration )
+
+    bool XMLGzipSink::Write( const char* data, size_t size )
     {
-        PushDeclaration( declaration.Value() );
-        return true;
+        if ( _failed || _finished ) {
+            return false;
+        }
+        if ( size > 0 ) {
+            _pending = true;
+            _failed = !Deflate( data, size, Z_NO_FLUSH );
+        }
+        return !_failed;
     }
 
 
-    bool XMLPrinter::Visit( const XMLUnknown& unknown )
+    bool XMLGzipSink::Flush()
     {
-        PushUnknown( unknown.Value() );
-        return true;
+        if ( _failed || _finished ) {
+            return !_failed;
+        }
+        // A sync flush with nothing new would still emit an empty block.
+        if ( _pending ) {
+            _pending = false;
+            _failed = !Deflate( 0, 0, Z_SYNC_FLUSH );
+        }
+        return !_failed && _next->Flush();
+    }
+
+
+    bool XMLGzipSink::Finish()
+    {
+        if ( _failed || _finished ) {
+            return !_failed;
+        }
+        _finished = true;
+        _failed = !Deflate( 0, 0, Z_FINISH ) || !_next->Flush();
+        return !_failed;
+    }
+#endif
+
+
+    /*
+     * Output tables for the printer. printClass classifies every byte value:
+     * the string terminator, the characters escaped in attribute values
+     * (all five entities) and the ones escaped in text (&, < and >; the
+     * last is not required, but consistency is nice).
+     */
+    static const unsigned char PRINT_END        = 1;
+    static const unsigned char PRINT_ENTITY     = 2;
+    static const unsigned char PRINT_RESTRICTED = 4;
+
+    static const unsigned char printClass[256] = {
+        PRINT_END, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, PRINT_ENTITY, 0, 0, 0, PRINT_ENTITY | PRINT_RESTRICTED, PRINT_ENTITY, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, PRINT_ENTITY | PRINT_RESTRICTED, 0, PRINT_ENTITY | PRINT_RESTRICTED, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+
+    // A newline followed by INDENT_LEVELS levels of INDENT_WIDTH spaces each,
+    // so line breaks and indentation normally take a single write.
+    static const int INDENT_WIDTH  = 4;
+    static const int INDENT_LEVELS = 16;
+    static const char printNewLine[INDENT_LEVELS * INDENT_WIDTH + 2] =
+        "\n                                                                ";
+    static const char* const printIndent = printNewLine + 1;
+
+    /*
+     * Constructor
+     */
+    XMLPrinter::XMLPrinter( FILE* file, bool compact, int depth ) :
+            _elementJustOpened( false ),
+            _stack(),
+            _firstElement( true ),
+            _fp( file ),
+            _depth( depth ),
+            _textDepth( -1 ),
+            _processEntities( true ),
+            _compactMode( compact ),
+            _outputMode( OUTPUT_UNRESOLVED ),
+            _counted( 0 ),
+            _sink( 0 ),
+            _sinkBufferSize( 0 ),
+            _sinkFailed( false ),
+            _buffer()
+    {
+        _buffer.Push( 0 );
+    }
+
+
+    XMLPrinter::XMLPrinter( XMLOutputSink& sink, bool compact, int depth, size_t bufferSize ) :
+            _elementJustOpened( false ),
+            _stack(),
+            _firstElement( true ),
+            _fp( 0 ),
+            _depth( depth ),
+            _textDepth( -1 ),
+            _processEntities( true ),
+            _compactMode( compact ),
+            _outputMode( OUTPUT_UNRESOLVED ),
+            _counted( 0 ),
+            _sink( &sink ),
+            _sinkBufferSize( bufferSize > 0 ? bufferSize : 1 ),
+            _sinkFailed( false ),
+            _buffer()
+    {
+        _buffer.Push( 0 );
+    }
+
+
+    XMLPrinter::~XMLPrinter()
+    {
+        Flush();
+    }
+
+    /**
+     * Function: Flush - write buffered output to the sink, and flush it
+     * @return false if any write to the sink failed
+     */
+    bool XMLPrinter::Flush()
+    {
+        if ( !_sink ) {
+            return true;
+        }
+        FlushBuffer();
+        if ( !_sink->Flush() ) {
+            _sinkFailed = true;
+        }
+        return !_sinkFailed;
+    }
+
+    /**
+     * Function: Reserve - make room for 'size' more bytes in print to memory mode
+     * @param size
+     */
+    void XMLPrinter::Reserve( size_t size )
+    {
+        if ( !_sink && !_fp ) {
+            _buffer.Reserve( _buffer.Size() + size );
+        }
+    }
+
+    /**
+     * Function: FlushBuffer - hand the buffered output to the sink
+     */
+    void XMLPrinter::FlushBuffer()
+    {
+        if ( _buffer.Size() > 1 && !_sink->Write( _buffer.Mem(), _buffer.Size() - 1 ) ) {
+            _sinkFailed = true;
+        }
+        _buffer.Clear();
+        _buffer.Push( 0 );
+    }
+
+    /**
+     * Function: SinkAppend - buffer 'data' for the sink, writing the buffer
+     * out when it fills. A fragment as large as the buffer is written along
+     * with the buffered output in one gather write rather than copied.
+     * @param data
+     * @param size
+     */
+    void XMLPrinter::SinkAppend( const char* data, size_t size )
+    {
+        if ( size >= _sinkBufferSize ) {
+            XMLOutputChunk chunks[2];
+            chunks[0].data = _buffer.Mem();
+            chunks[0].size = _buffer.Size() - 1;
+            chunks[1].data = data;
+            chunks[1].size = size;
+            const bool buffered = chunks[0].size > 0;
+            if ( !_sink->WriteV( buffered ? chunks : chunks + 1, buffered ? 2 : 1 ) ) {
+                _sinkFailed = true;
+            }
+            _buffer.Clear();
+            _buffer.Push( 0 );
+            return;
+        }
+        char* p = _buffer.PushArr( size ) - 1;   // back up over the null terminator.
+        memcpy( p, data, size );
+        p[size] = 0;
+        if ( _buffer.Size() > _sinkBufferSize ) {
+            FlushBuffer();
+        }
+    }
+
+    /**
+     * Function: Print - print based on va_list format
+     * @param format
+     * @param ...
+     */
+    void XMLPrinter::Print( const char* format, ... )
+    {
+        va_list     va;
+        va_start( va, format );
+
+        if ( _fp ) {
+            vfprintf( _fp, format, va );
+        }
+        else {
+            const int len = TIXML_VSCPRINTF( format, va );
+            // Close out and re-start the va-args
+            va_end( va );
+            TIXMLASSERT( len >= 0 );
+            va_start( va, format );
+            TIXMLASSERT( _buffer.Size() > 0 && _buffer[_buffer.Size() - 1] == 0 );
+            char* p = _buffer.PushArr( len ) - 1;	// back up over the null terminator.
+            TIXML_VSNPRINTF( p, len+1, format, va );
+            if ( _sink && _buffer.Size() > _sinkBufferSize ) {
+                FlushBuffer();
+            }
+        }
+        va_end( va );
+    }
+
+    /**
+     * Function: Write - write 'data' to the printer file
+     * @param data
+     * @param size
+     */
+    void XMLPrinter::Write( const char* data, size_t size )
+    {
+        if ( _sink ) {
+            SinkAppend( data, size );
+        }
+        else if ( _fp ) {
+            fwrite ( data , sizeof(char), size, _fp);
+        }
+        else {
+            char* p = _buffer.PushArr( size ) - 1;   // back up over the null terminator.
+            memcpy( p, data, size );
+            p[size] = 0;
+        }
+    }
+
+    /**
+     * Function: Putc - write 'ch' to the printer file
+     * @param ch
+     */
+    void XMLPrinter::Putc( char ch )
+    {
+        if ( _sink ) {
+            SinkAppend( &ch, 1 );
+        }
+        else if ( _fp ) {
+            fputc ( ch, _fp);
+        }
+        else {
+            char* p = _buffer.PushArr( sizeof(char) ) - 1;   // back up over the null terminator.
+            p[0] = ch;
+            p[1] = 0;
+        }
+    }
+
+    /**
+     * Function: PrintSpace - frint spaces as much as 'depth'
+     * @param depth
+     */
+    void XMLPrinter::PrintSpace( int depth )
+    {
+        // One Write covers INDENT_LEVELS levels; only pathologically deep
+        // documents need more than one.
+        while ( depth > 0 ) {
+            const int levels = depth < INDENT_LEVELS ? depth : INDENT_LEVELS;
+            Write( printIndent, static_cast<size_t>( levels ) * INDENT_WIDTH );
+            depth -= levels;
+        }
+    }
+
+    /**
+     * Function: AppendSpace - indent by 'depth' levels; a subclass gets a
+     * PrintSpace() call
+     * @param depth
+     */
+    void XMLPrinter::AppendSpace( int depth )
+    {
+        if ( _outputMode == OUTPUT_UNRESOLVED ) {
+            ResolveOutputMode();
+        }
+        if ( _outputMode == OUTPUT_HOOKED ) {
+            PrintSpace( depth );
+            return;
+        }
+        while ( depth > 0 ) {
+            const int levels = depth < INDENT_LEVELS ? depth : INDENT_LEVELS;
+            Append( printIndent, static_cast<size_t>( levels ) * INDENT_WIDTH );
+            depth -= levels;
+        }
+    }
+
+    /**
+     * Function: AppendNewLine - line break, then indent by 'depth' levels
+     * @param depth
+     */
+    void XMLPrinter::AppendNewLine( int depth )
+    {
+        if ( _outputMode == OUTPUT_MEMORY && depth <= INDENT_LEVELS ) {
+            Append( printNewLine, 1 + static_cast<size_t>( depth ) * INDENT_WIDTH );
+            return;
+        }
+        if ( _outputMode == OUTPUT_COUNT ) {
+            _counted += 1 + static_cast<size_t>( depth ) * INDENT_WIDTH;
+            return;
+        }
+        Append( '\n' );
+        AppendSpace( depth );
+    }
+
+    /**
+     * Function: AppendSlow - output 'data' anywhere but the in-memory fast path
+     * @param data
+     * @param size
+     */
+    void XMLPrinter::AppendSlow( const char* data, size_t size )
+    {
+        if ( _outputMode == OUTPUT_UNRESOLVED ) {
+            ResolveOutputMode();
+            Append( data, size );
+        }
+        else if ( _outputMode == OUTPUT_COUNT ) {
+            _counted += size;
+        }
+        else if ( _outputMode == OUTPUT_SINK ) {
+            SinkAppend( data, size );
+        }
+        else if ( _outputMode == OUTPUT_FILE ) {
+            fwrite( data, sizeof(char), size, _fp );
+        }
+        else {
+            Write( data, size );
+        }
+    }
+
+
+    void XMLPrinter::AppendSlow( char ch )
+    {
+        if ( _outputMode == OUTPUT_UNRESOLVED ) {
+            ResolveOutputMode();
+            Append( ch );
+        }
+        else if ( _outputMode == OUTPUT_COUNT ) {
+            ++_counted;
+        }
+        else if ( _outputMode == OUTPUT_SINK ) {
+            SinkAppend( &ch, 1 );
+        }
+        else if ( _outputMode == OUTPUT_FILE ) {
+            fputc( ch, _fp );
+        }
+        else {
+            Putc( ch );
+        }
+    }
+
+    /**
+     * Function: ResolveOutputMode - decide, on first output, whether the core
+     * may bypass the virtual output hooks. Only an exact XMLPrinter can: any
+     * subclass might override Write(), Putc() or PrintSpace(), so subclasses
+     * keep receiving every fragment through them. Without RTTI there is no
+     * way to tell, and the hooks are always used.
+     */
+    void XMLPrinter::ResolveOutputMode()
+    {
+        _outputMode = OUTPUT_HOOKED;
+#ifdef TIXML_HAS_RTTI
+        if ( typeid( *this ) == typeid( XMLPrinter ) ) {
+            _outputMode = _sink ? OUTPUT_SINK : ( _fp ? OUTPUT_FILE : OUTPUT_MEMORY );
+        }
+#endif
+    }
+
+    /*
+     * Function: FindEscape - return the first byte at or after 'p' that is
+     * the string terminator or must be written as an entity: & < > in text,
+     * and " ' as well in attribute values ('restricted' false).
+     */
+    static const char* FindEscape( const char* p, bool restricted )
+    {
+        const unsigned char stop = static_cast<unsigned char>( PRINT_END | ( restricted ? PRINT_RESTRICTED : PRINT_ENTITY ) );
+#ifdef TIXML_SSE2
+        // Bytes up to the first 16 byte boundary, one at a time.
+        while ( reinterpret_cast<uintptr_t>( p ) & 15 ) {
+            if ( printClass[static_cast<unsigned char>(*p)] & stop ) {
+                return p;
+            }
+            ++p;
+        }
+        // Then 16 at a time. In text, the quote comparisons repeat '&'.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i amp  = _mm_set1_epi8( '&' );
+        const __m128i lt   = _mm_set1_epi8( '<' );
+        const __m128i gt   = _mm_set1_epi8( '>' );
+        const __m128i quot = _mm_set1_epi8( restricted ? '&' : DOUBLE_QUOTE );
+        const __m128i apos = _mm_set1_epi8( restricted ? '&' : SINGLE_QUOTE );
+        for( ;; ) {
+            const __m128i v = _mm_load_si128( reinterpret_cast<const __m128i*>( p ) );
+            __m128i hit = _mm_or_si128( _mm_cmpeq_epi8( v, zero ), _mm_cmpeq_epi8( v, amp ) );
+            hit = _mm_or_si128( hit, _mm_or_si128( _mm_cmpeq_epi8( v, lt ), _mm_cmpeq_epi8( v, gt ) ) );
+            hit = _mm_or_si128( hit, _mm_or_si128( _mm_cmpeq_epi8( v, quot ), _mm_cmpeq_epi8( v, apos ) ) );
+            const unsigned mask = static_cast<unsigned>( _mm_movemask_epi8( hit ) );
+            if ( mask ) {
+#if defined(_MSC_VER)
+                unsigned long index;
+                _BitScanForward( &index, mask );
+                return p + index;
+#else
+                return p + __builtin_ctz( mask );
+#endif
+            }
+            p += 16;
+        }
+#else
+        while ( !( printClass[static_cast<unsigned char>(*p)] & stop ) ) {
+            ++p;
+        }
+        return p;
+#endif
+    }
+
+    /**
+     * Function: PrintString - write a string to the printer file
+     * @param p
+     * @param restricted
+     */
+    void XMLPrinter::PrintString( const char* p, bool restricted )
+    {
+        if ( !_processEntities ) {
+            Append( p );
+            return;
+        }
+        // Look for runs of bytes between entities to print. A string with
+        // nothing to escape is a single run, written with one Append().
+        const char* q = p;
+        for( ;; ) {
+            q = FindEscape( q, restricted );
+            if ( p < q ) {
+                Append( p, q - p );
+            }
+            if ( !*q ) {
+                break;
+            }
+            // Write the whole reference, "&amp;" etc., in one call.
+            bool entityPatternPrinted = false;
+            for( int i=0; i<NUM_ENTITIES; ++i ) {
+                if ( entities[i].value == *q ) {
+                    char ref[8];
+                    ref[0] = '&';
+                    memcpy( ref + 1, entities[i].pattern, entities[i].length );
+                    ref[entities[i].length + 1] = ';';
+                    Append( ref, entities[i].length + 2 );
+                    entityPatternPrinted = true;
+                    break;
+                }
+            }
+            if ( !entityPatternPrinted ) {
+                // TIXMLASSERT( entityPatternPrinted ) causes gcc -Wunused-but-set-variable in release
+                TIXMLASSERT( false );
+            }
+            p = ++q;
+        }
+    }
+
+    /**
+     * Function: PushHeader - write BOB or Decleration
+     * @param writeBOM
+     * @param writeDec
+     */
+    void XMLPrinter::PushHeader( bool writeBOM, bool writeDec )
+    {
+        if ( writeBOM ) {
+            static const unsigned char bom[] = { TIXML_UTF_LEAD_0, TIXML_UTF_LEAD_1, TIXML_UTF_LEAD_2, 0 };
+            Append( reinterpret_cast< const char* >( bom ) );
+        }
+        if ( writeDec ) {
+            PushDeclaration( "xml version=\"1.0\"" );
+        }
+    }
+
+    /**
+     * Function: PrepareForNewNode - create new line and idente once for prepering printing the next node
+     * @param compactMode
+     */
+    void XMLPrinter::PrepareForNewNode( bool compactMode )
+    {
+        SealElementIfJustOpened();
+
+        if ( compactMode ) {
+            return;
+        }
+
+        if ( _firstElement ) {
+            AppendSpace( _depth );
+        } else if ( _textDepth < 0) {
+            AppendNewLine( _depth );
+        }
+
+        _firstElement = false;
+    }
+
+    /**
+     * Function: OpenElement - print  <'name'
+     * @param name
+     * @param compactMode
+     */
+    void XMLPrinter::OpenElement( const char* name, bool compactMode )
+    {
+        PrepareForNewNode( compactMode );
+        _stack.Push( name );
+
+        Append( "<" );
+        Append( name );
+
+        _elementJustOpened = true;
+        ++_depth;
+    }
+
+    /**
+     * Function: PushAttribute - print attribute to the file with string value
+     * @param name
+     * @param value
+     */
+    void XMLPrinter::PushAttribute( const char* name, const char* value )
+    {
+        TIXMLASSERT( _elementJustOpened );
+        Append( ' ' );
+        Append( name );
+        Append( "=\"" );
+        PrintString( value, false );
+        Append( '\"' );
+    }
+
+    /**
+     * PushAttribute - print attribute to the file with int value
+     * @param name
+     * @param v
+     */
+    void XMLPrinter::PushAttribute( const char* name, int v )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( v, buf, BUF_SIZE );
+        PushAttribute( name, buf );
+    }
+
+
+    void XMLPrinter::PushAttribute( const char* name, unsigned v )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( v, buf, BUF_SIZE );
+        PushAttribute( name, buf );
+    }
+
+
+    void XMLPrinter::PushAttribute(const char* name, int64_t v)
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr(v, buf, BUF_SIZE);
+        PushAttribute(name, buf);
+    }
+
+
+    void XMLPrinter::PushAttribute(const char* name, uint64_t v)
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr(v, buf, BUF_SIZE);
+        PushAttribute(name, buf);
+    }
+
+
+    void XMLPrinter::PushAttribute( const char* name, bool v )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( v, buf, BUF_SIZE );
+        PushAttribute( name, buf );
+    }
+
+
+    void XMLPrinter::PushAttribute( const char* name, double v )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( v, buf, BUF_SIZE );
+        PushAttribute( name, buf );
+    }
+
+    /**
+     * Function: CloseElement - print element clouser
+     * @param compactMode
+     */
+    void XMLPrinter::CloseElement( bool compactMode )
+    {
+        --_depth;
+        const char* name = _stack.Pop();
+
+        if ( _elementJustOpened ) {
+            Append( "/>" );
+        }
+        else {
+            if ( _textDepth < 0 && !compactMode) {
+                AppendNewLine( _depth );
+            }
+            Append( "</" );
+            Append( name );
+            Append( ">" );
+        }
+
+        if ( _textDepth == _depth ) {
+            _textDepth = -1;
+        }
+        if ( _depth == 0 && !compactMode) {
+            Append( '\n' );
+        }
+        _elementJustOpened = false;
+    }
+
+    /**
+     * Function: SealElementIfJustOpened - clouse open element with '>'
+     */
+    void XMLPrinter::SealElementIfJustOpened()
+    {
+        if ( !_elementJustOpened ) {
+            return;
+        }
+        _elementJustOpened = false;
+        Append( '>' );
+    }
+
+    /**
+     * Function: PushText - print 'text' to file. may be CDATA
+     * @param text
+     * @param cdata
+     */
+    void XMLPrinter::PushText( const char* text, bool cdata )
+    {
+        _textDepth = _depth-1;
+
+        SealElementIfJustOpened();
+        if ( cdata ) {
+            Append( "<![CDATA[" );
+            Append( text );
+            Append( "]]>" );
+        }
+        else {
+            PrintString( text, true );
+        }
+    }
+
+
+    void XMLPrinter::PushText( int64_t value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+
+    void XMLPrinter::PushText( uint64_t value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr(value, buf, BUF_SIZE);
+        PushText(buf, false);
+    }
+
+
+    void XMLPrinter::PushText( int value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+
+    void XMLPrinter::PushText( unsigned value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+
+    void XMLPrinter::PushText( bool value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+
+    void XMLPrinter::PushText( float value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+
+    void XMLPrinter::PushText( double value )
+    {
+        char buf[BUF_SIZE];
+        XMLUtil::ToStr( value, buf, BUF_SIZE );
+        PushText( buf, false );
+    }
+
+    /**
+     * Function: PushComment - print 'comment' to the file
+     * @param comment
+     */
+    void XMLPrinter::PushComment( const char* comment )
+    {
+        PrepareForNewNode( _compactMode );
+
+        Append( "<!--" );
+        Append( comment );
+        Append( "-->" );
+    }
+
+    /**
+     * Function: PushDeclaration - print 'value' as decleration
+     * @param value
+     */
+    void XMLPrinter::PushDeclaration( const char* value )
+    {
+        PrepareForNewNode( _compactMode );
+
+        Append( "<?" );
+        Append( value );
+        Append( "?>" );
+    }
+
+    /**
+     * Function: PushUnknown - print 'value' as unkown
+     * @param value
+     */
+    void XMLPrinter::PushUnknown( const char* value )
+    {
+        PrepareForNewNode( _compactMode );
+
+        Append( "<!" );
+        Append( value );
+        Append( '>' );
+    }
+
+
+    bool XMLPrinter::VisitEnter( const XMLDocument& doc )
+    {
+        _processEntities = doc.ProcessEntities();
+        if ( doc.HasBOM() ) {
+            PushHeader( true, false );
+        }
+        return true;
+    }
+
+
+    bool XMLPrinter::VisitExit( const XMLDocument& /*doc*/ )
+    {
+        if ( _sink ) {
+            FlushBuffer();
+        }
+        return true;
+    }
+
+
+    bool XMLPrinter::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
+    {
+        const XMLElement* parentElem = 0;
+        if ( element.Parent() ) {
+            parentElem = element.Parent()->ToElement();
+        }
+        const bool compactMode = parentElem ? CompactMode( *parentElem ) : _compactMode;
+        OpenElement( element.Name(), compactMode );
+        while ( attribute ) {
+            PushAttribute( attribute->Name(), attribute->Value() );
+            attribute = attribute->Next();
+        }
+        return true;
+    }
+
+
+    bool XMLPrinter::VisitExit( const XMLElement& element )
+    {
+        CloseElement( CompactMode(element) );
+        return true;
+    }
+
+
+    bool XMLPrinter::Visit( const XMLText& text )
+    {
+        PushText( text.Value(), text.CData() );
+        return true;
+    }
+
+
+    bool XMLPrinter::Visit( const XMLComment& comment )
+    {
+        PushComment( comment.Value() );
+        return true;
+    }
+
+    bool XMLPrinter::Visit( const XMLDeclaration& declaration )
+    {
+        PushDeclaration( declaration.Value() );
+        return true;
+    }
+
+
+    bool XMLPrinter::Visit( const XMLUnknown& unknown )
+    {
+        PushUnknown( unknown.Value() );
+        return true;
+    }
+
+
+#ifdef TINYXML2_HAS_THREADS
+    /*
+     * Shared state of one parallel Print(): the runs of siblings, the
+     * finished runs waiting to be written, and the window that keeps the
+     * workers from running too far ahead of the writer.
+     */
+    struct XMLParallelPrinter::Job {
+        Job() : doc( 0 ), compact( false ), depth( 0 ), chunks( 0 ), window( 0 ),
+                first( 0 ), count( 0 ), done( 0 ), next( 0 ), written( 0 ), workers( 0 ) {}
+
+        // Also on the way out of an exception: the workers waiting for the
+        // writer are let go, all of them joined, and the runs freed.
+        ~Job() {
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                next = chunks;
+            }
+            progress.notify_all();
+            delete workers;
+            for( int i = 0; done && i < chunks; ++i ) {
+                delete done[i];
+            }
+            delete [] first;
+            delete [] count;
+            delete [] done;
+        }
+
+        const XMLDocument*      doc;
+        bool                    compact;
+        int                     depth;      // printer depth of the split element's children
+        int                     chunks;
+        int                     window;
+        const XMLNode**         first;      // first node of each run
+        int*                    count;      // nodes in each run
+        XMLPrinter**            done;       // finished runs, written in order
+        int                     next;       // next run to start
+        int                     written;    // runs written to the sink
+        std::mutex              mutex;
+        std::condition_variable finished;   // a run was printed
+        std::condition_variable progress;   // a run was written
+        XMLThreadGroup*         workers;
+    };
+
+    /*
+     * Prints the document around the split element, and in its place the
+     * runs of its children, as they finish, in order.
+     */
+    class XMLParallelPrinter::Spine : public XMLPrinter
+    {
+    public:
+        Spine( XMLOutputSink& sink, bool compact, const XMLElement* split, Job* job ) :
+            XMLPrinter( sink, compact ), _split( split ), _job( job )	{}
+
+        using XMLPrinter::VisitEnter;
+        using XMLPrinter::VisitExit;
+
+        virtual bool VisitEnter( const XMLElement& element, const XMLAttribute* attribute ) {
+            XMLPrinter::VisitEnter( element, attribute );
+            return &element != _split;
+        }
+
+        virtual bool VisitExit( const XMLElement& element ) {
+            if ( &element == _split ) {
+                // What the sequential printer writes between siblings with
+                // no text among them: after the '>' sealing the split
+                // element, a line break before each child. A fresh printer
+                // at the right depth writes the indentation itself.
+                SealElementIfJustOpened();
+                for( int i = 0; i < _job->chunks; ++i ) {
+                    XMLPrinter* chunk = 0;
+                    {
+                        std::unique_lock<std::mutex> lock( _job->mutex );
+                        while ( !_job->done[i] ) {
+                            _job->finished.wait( lock );
+                        }
+                        chunk = _job->done[i];
+                        _job->done[i] = 0;
+                    }
+                    if ( !_job->compact ) {
+                        Write( "\n", 1 );
+                    }
+                    Write( chunk->CStr(), chunk->CStrSize() - 1 );
+                    delete chunk;
+                    {
+                        std::lock_guard<std::mutex> lock( _job->mutex );
+                        ++_job->written;
+                    }
+                    _job->progress.notify_all();
+                }
+            }
+            return XMLPrinter::VisitExit( element );
+        }
+
+    private:
+        const XMLElement* _split;
+        Job* _job;
+    };
+
+
+    XMLParallelPrinter::XMLParallelPrinter( int threads, bool compact ) :
+        _threads( threads ),
+        _compact( compact ),
+        _chunks( 0 )
+    {
+        if ( _threads <= 0 ) {
+            _threads = static_cast<int>( std::thread::hardware_concurrency() );
+        }
+        if ( _threads <= 0 ) {
+            _threads = 1;
+        }
+    }
+
+    /**
+     * Function: FindSplit - the element whose children are printed in
+     * parallel: the root, or the first element with more than one child
+     * below a chain of single children. Null if there is none, or if it
+     * has text children.
+     * @param doc
+     * @return
+     */
+    const XMLElement* XMLParallelPrinter::FindSplit( const XMLDocument& doc )
+    {
+        const XMLElement* split = doc.RootElement();
+        while ( split ) {
+            const XMLNode* only = split->FirstChild();
+            if ( !only ) {
+                return 0;
+            }
+            if ( only->NextSibling() ) {
+                break;
+            }
+            split = only->ToElement();
+        }
+        if ( !split ) {
+            return 0;
+        }
+        for( const XMLNode* node = split->FirstChild(); node; node = node->NextSibling() ) {
+            if ( node->ToText() ) {
+                return 0;
+            }
+        }
+        return split;
+    }
+
+
+    void XMLParallelPrinter::Worker( Job* job )
+    {
+        for( ;; ) {
+            int index = 0;
+            {
+                std::unique_lock<std::mutex> lock( job->mutex );
+                while ( job->next < job->chunks && job->next >= job->written + job->window ) {
+                    job->progress.wait( lock );
+                }
+                if ( job->next >= job->chunks ) {
+                    return;
+                }
+                index = job->next++;
+            }
+            XMLPrinter* printer = new XMLPrinter( 0, job->compact, job->depth );
+            printer->_processEntities = job->doc->ProcessEntities();
+            const XMLNode* node = job->first[index];
+            for( int i = 0; i < job->count[index]; ++i ) {
+                node->Accept( printer );
+                node = node->NextSibling();
+            }
+            {
+                std::lock_guard<std::mutex> lock( job->mutex );
+                job->done[index] = printer;
+            }
+            job->finished.notify_all();
+        }
+    }
+
+
+    bool XMLParallelPrinter::Print( const XMLDocument& doc, XMLOutputSink& sink )
+    {
+        _chunks = 0;
+        const XMLElement* split = _threads > 1 ? FindSplit( doc ) : 0;
+        if ( !split ) {
+            XMLPrinter printer( sink, _compact );
+            doc.Print( &printer );
+            return printer.Flush();
+        }
+
+        int children = 0;
+        for( const XMLNode* node = split->FirstChild(); node; node = node->NextSibling() ) {
+            ++children;
+        }
+        int depth = 1;
+        for( const XMLNode* node = split->Parent(); node && node->ToElement(); node = node->Parent() ) {
+            ++depth;
+        }
+
+        Job job;
+        job.doc = &doc;
+        job.compact = _compact;
+        job.depth = depth;
+        job.chunks = children < _threads * CHUNKS_PER_THREAD ? children : _threads * CHUNKS_PER_THREAD;
+        job.window = 2 * _threads;
+        job.first = new const XMLNode*[job.chunks];
+        job.count = new int[job.chunks];
+        job.done = new XMLPrinter*[job.chunks]();
+
+        // Equal numbers of siblings per run; the first runs take the remainder.
+        const XMLNode* node = split->FirstChild();
+        for( int i = 0; i < job.chunks; ++i ) {
+            job.first[i] = node;
+            job.count[i] = children / job.chunks + ( i < children % job.chunks ? 1 : 0 );
+            for( int j = 0; j < job.count[i]; ++j ) {
+                node = node->NextSibling();
+            }
+        }
+
+        const int workers = _threads < job.chunks ? _threads : job.chunks;
+        job.workers = new XMLThreadGroup( workers );
+        for( int i = 0; i < workers; ++i ) {
+            job.workers->Start( Worker, &job );
+        }
+        bool ok = false;
+        {
+            Spine spine( sink, _compact, split, &job );
+            doc.Accept( &spine );
+            ok = spine.Flush();
+        }
+        job.workers->Join();
+        _chunks = job.chunks;
+        return ok;
+    }
+#endif
+
+
+    /*
+     * XMLDiff and XMLPatch.
+     *
+     * The differ walks pairs of matched nodes. For each pair it compares the
+     * values and attributes, then lines up the children: first by subtree
+     * hash (equal subtrees need nothing), then by kind and element name
+     * (those pairs are diffed in turn). Unpaired children of 'from' are
+     * deleted and unpaired children of 'to' inserted. Of the paired ones,
+     * the longest run already in the right relative order stays put; each
+     * of the others is moved to just after its predecessor in 'to'. The
+     * pairs are walked with an explicit stack, so the depth of the trees
+     * doesn't matter.
+     */
+    struct XMLDiffKey {
+        uint64_t    key;
+        int         index;
+    };
+
+    static int CompareDiffKeys( const void* p, const void* q )
+    {
+        const XMLDiffKey* a = static_cast<const XMLDiffKey*>( p );
+        const XMLDiffKey* b = static_cast<const XMLDiffKey*>( q );
+        if ( a->key != b->key ) {
+            return a->key < b->key ? -1 : 1;
+        }
+        return a->index - b->index;
+    }
+
+    // The key children are paired on when their subtrees differ: the node
+    // type, and the name of an element.
+    static uint64_t DiffKindKey( const XMLNode* node )
+    {
+        const unsigned char kind = static_cast<unsigned char>( node->Type() );
+        const XMLElement* element = node->ToElement();
+        return element ? HashString( HashByte( HASH_OFFSET, kind ), element->Name() ) : kind;
+    }
+
+    static bool DiffKindEqual( const XMLNode* a, const XMLNode* b )
+    {
+        if ( a->Type() != b->Type() ) {
+            return false;
+        }
+        const XMLElement* ea = a->ToElement();
+        return !ea || XMLUtil::StringEqual( ea->Name(), b->ToElement()->Name() );
+    }
+
+    static bool IsWhiteSpaceOnly( const char* p )
+    {
+        while ( *p && XMLUtil::IsWhiteSpace( *p ) ) {
+            ++p;
+        }
+        return *p == 0;
+    }
+
+    // A pair of nodes to diff, child 'index' of the pair above it (-1 at
+    // the top); a null 'a' marks where to cut the path back to 'mark'.
+    struct XMLDiffWork {
+        const XMLNode*  a;
+        const XMLNode*  b;
+        int             index;
+        size_t          mark;
+    };
+
+    class XMLDiffer
+    {
+    public:
+        XMLDiffer( XMLDocument* script, XMLElement* root ) : _script( script ), _root( root ) {
+            _path.Push( 0 );
+        }
+
+        void Diff( const XMLNode* from, const XMLNode* to ) {
+            // Depth first: the differing child pairs of a pair are pushed
+            // last to first, above the marker that restores its path.
+            XMLDiffWork top = { from, to, -1, 0 };
+            _work.Push( top );
+            while ( !_work.Empty() ) {
+                const XMLDiffWork work = _work.Pop();
+                if ( !work.a ) {
+                    PopTo( work.mark );
+                    continue;
+                }
+                if ( work.index >= 0 ) {
+                    XMLDiffWork restore = { 0, 0, -1, PushIndex( work.index ) };
+                    _work.Push( restore );
+                }
+                DiffNode( work.a, work.b );
+            }
+        }
+
+    private:
+        XMLDiffer( const XMLDiffer& );          // not supported
+        void operator=( const XMLDiffer& );     // not supported
+
+        void DiffNode( const XMLNode* a, const XMLNode* b ) {
+            if ( a->Hash() == b->Hash() ) {
+                return;
+            }
+            if ( !a->ToDocument() && !XMLUtil::StringEqual( a->Value(), b->Value() ) ) {
+                AddOp( "value" )->SetAttribute( "value", b->Value() );
+            }
+            if ( a->ToElement() ) {
+                DiffAttributes( a->ToElement(), b->ToElement() );
+            }
+            DiffChildren( a, b );
+        }
+
+        XMLElement* AddOp( const char* name ) {
+            XMLElement* op = _script->NewElement( name );
+            _root->InsertEndChild( op );
+            op->SetAttribute( "path", _path.Mem() );
+            return op;
+        }
+
+        // Append "/index" to the path; returns the size to restore.
+        size_t PushIndex( int index ) {
+            const size_t mark = _path.Size();
+            char buf[BUF_SIZE];
+            XMLUtil::ToStr( index, buf, BUF_SIZE );
+            const size_t len = strlen( buf );
+            char* p = _path.PushArr( len + ( mark > 1 ? 1 : 0 ) ) - 1;   // back up over the null terminator.
+            if ( mark > 1 ) {
+                *p++ = '/';
+            }
+            memcpy( p, buf, len + 1 );
+            return mark;
+        }
+
+        void PopTo( size_t mark ) {
+            _path.PopArr( _path.Size() - mark );
+            _path[mark - 1] = 0;
+        }
+
+        void DiffAttributes( const XMLElement* a, const XMLElement* b ) {
+            // Attributes kept from 'a' stay in their order and new ones go
+            // to the end. If 'b' has another order, set them all again.
+            bool ordered = true;
+            const XMLAttribute* kept = NextKept( a->FirstAttribute(), b );
+            for( const XMLAttribute* y = b->FirstAttribute(); y && ordered; y = y->Next() ) {
+                if ( kept ) {
+                    ordered = XMLUtil::StringEqual( kept->Name(), y->Name() );
+                    kept = NextKept( kept->Next(), b );
+                }
+                else {
+                    ordered = a->FindAttribute( y->Name() ) == 0;
+                }
+            }
+            for( const XMLAttribute* x = a->FirstAttribute(); x; x = x->Next() ) {
+                if ( !ordered || !b->FindAttribute( x->Name() ) ) {
+                    AddOp( "unset" )->SetAttribute( "name", x->Name() );
+                }
+            }
+            for( const XMLAttribute* y = b->FirstAttribute(); y; y = y->Next() ) {
+                const XMLAttribute* x = ordered ? a->FindAttribute( y->Name() ) : 0;
+                if ( !x || !XMLUtil::StringEqual( x->Value(), y->Value() ) ) {
+                    XMLElement* op = AddOp( "set" );
+                    op->SetAttribute( "name", y->Name() );
+                    op->SetAttribute( "value", y->Value() );
+                }
+            }
+        }
+
+        static const XMLAttribute* NextKept( const XMLAttribute* a, const XMLElement* b ) {
+            while ( a && !b->FindAttribute( a->Name() ) ) {
+                a = a->Next();
+            }
+            return a;
+        }
+
+        // Pair the unpaired entries of 'a' and 'b' whose keys are equal, in
+        // document order. 'exact' keys are subtree hashes; otherwise the
+        // kind key, checked against a hash collision.
+        static void Pair( const DynArray<const XMLNode*, 16>& a, const DynArray<const XMLNode*, 16>& b,
+                          DynArray<int, 16>& matchA, DynArray<int, 16>& matchB, bool exact ) {
+            DynArray<XMLDiffKey, 16> ka;
+            DynArray<XMLDiffKey, 16> kb;
+            for( size_t i = 0; i < a.Size(); ++i ) {
+                if ( matchA[i] < 0 ) {
+                    XMLDiffKey k = { exact ? a[i]->Hash() : DiffKindKey( a[i] ), static_cast<int>( i ) };
+                    ka.Push( k );
+                }
+            }
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                if ( matchB[j] < 0 ) {
+                    XMLDiffKey k = { exact ? b[j]->Hash() : DiffKindKey( b[j] ), static_cast<int>( j ) };
+                    kb.Push( k );
+                }
+            }
+            if ( ka.Empty() || kb.Empty() ) {
+                return;
+            }
+            qsort( ka.Mem(), ka.Size(), sizeof( XMLDiffKey ), CompareDiffKeys );
+            qsort( kb.Mem(), kb.Size(), sizeof( XMLDiffKey ), CompareDiffKeys );
+            size_t i = 0;
+            size_t j = 0;
+            while ( i < ka.Size() && j < kb.Size() ) {
+                if ( ka[i].key < kb[j].key ) {
+                    ++i;
+                }
+                else if ( kb[j].key < ka[i].key ) {
+                    ++j;
+                }
+                else {
+                    const int x = ka[i].index;
+                    const int y = kb[j].index;
+                    if ( exact || DiffKindEqual( a[x], b[y] ) ) {
+                        matchA[x] = y;
+                        matchB[y] = x;
+                    }
+                    ++i;
+                    ++j;
+                }
+            }
+        }
+
+        // The children during the moves are counted with a Fenwick tree
+        // over 'slots', positions that keep the order of the children as
+        // the script leaves them: a child's index is the number of
+        // occupied slots before its own.
+        static void OccupySlot( DynArray<int, 16>& tree, size_t slot, int delta ) {
+            for( size_t i = slot + 1; i <= tree.Size(); i += i & ( 0 - i ) ) {
+                tree[i - 1] += delta;
+            }
+        }
+
+        static int SlotIndex( const DynArray<int, 16>& tree, size_t slot ) {
+            int count = 0;
+            for( size_t i = slot; i > 0; i -= i & ( 0 - i ) ) {
+                count += tree[i - 1];
+            }
+            return count;
+        }
+
+        void DiffChildren( const XMLNode* pa, const XMLNode* pb ) {
+            DynArray<const XMLNode*, 16> a;
+            DynArray<const XMLNode*, 16> b;
+            for( const XMLNode* node = pa->FirstChild(); node; node = node->NextSibling() ) {
+                a.Push( node );
+            }
+            for( const XMLNode* node = pb->FirstChild(); node; node = node->NextSibling() ) {
+                b.Push( node );
+            }
+            DynArray<int, 16> matchA;
+            DynArray<int, 16> matchB;
+            for( size_t i = 0; i < a.Size(); ++i ) {
+                matchA.Push( -1 );
+            }
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                matchB.Push( -1 );
+            }
+            Pair( a, b, matchA, matchB, true );
+            DynArray<bool, 16> same;
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                same.Push( matchB[j] >= 0 );
+            }
+            Pair( a, b, matchA, matchB, false );
+
+            // Deletes, last first, so the indices hold.
+            for( size_t i = a.Size(); i-- > 0; ) {
+                if ( matchA[i] < 0 ) {
+                    const size_t mark = PushIndex( static_cast<int>( i ) );
+                    AddOp( "delete" );
+                    PopTo( mark );
+                }
+            }
+
+            // The longest increasing run of 'a' indices, in 'b' order,
+            // stays; patience sorting with back links.
+            DynArray<int, 16> tails;    // b index ending the best run of each length
+            DynArray<int, 16> back;     // per b index: previous b index in its run
+            DynArray<bool, 16> stays;
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                back.Push( -1 );
+                stays.Push( false );
+                const int x = matchB[j];
+                if ( x < 0 ) {
+                    continue;
+                }
+                size_t lo = 0;
+                size_t hi = tails.Size();
+                while ( lo < hi ) {
+                    const size_t mid = ( lo + hi ) / 2;
+                    if ( matchB[tails[mid]] < x ) {
+                        lo = mid + 1;
+                    }
+                    else {
+                        hi = mid;
+                    }
+                }
+                back[j] = lo > 0 ? tails[lo - 1] : -1;
+                if ( lo == tails.Size() ) {
+                    tails.Push( static_cast<int>( j ) );
+                }
+                else {
+                    tails[lo] = static_cast<int>( j );
+                }
+            }
+            for( int j = tails.Empty() ? -1 : tails.PeekTop(); j >= 0; j = back[j] ) {
+                stays[j] = true;
+            }
+
+            // Everything else goes right after its predecessor in 'b', so
+            // each child that stays is followed by the run of 'b' children
+            // up to the next one that stays. Lay out the slots that way:
+            // the run before the first child that stays, then the kept
+            // children of 'a' in order, each that stays with its run.
+            DynArray<size_t, 16> fromSlot;  // per a index
+            DynArray<size_t, 16> toSlot;    // per b index
+            for( size_t i = 0; i < a.Size(); ++i ) {
+                fromSlot.Push( 0 );
+            }
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                toSlot.Push( 0 );
+            }
+            size_t slots = 0;
+            for( size_t j = 0; j < b.Size() && !stays[j]; ++j ) {
+                toSlot[j] = slots++;
+            }
+            for( size_t i = 0; i < a.Size(); ++i ) {
+                const int y = matchA[i];
+                if ( y < 0 ) {
+                    continue;
+                }
+                fromSlot[i] = slots++;
+                if ( stays[y] ) {
+                    toSlot[y] = fromSlot[i];
+                    for( size_t j = static_cast<size_t>( y ) + 1; j < b.Size() && !stays[j]; ++j ) {
+                        toSlot[j] = slots++;
+                    }
+                }
+            }
+            DynArray<int, 16> tree;
+            for( size_t i = 0; i < slots; ++i ) {
+                tree.Push( 0 );
+            }
+            for( size_t i = 0; i < a.Size(); ++i ) {
+                if ( matchA[i] >= 0 ) {
+                    OccupySlot( tree, fromSlot[i], 1 );
+                }
+            }
+
+            for( size_t j = 0; j < b.Size(); ++j ) {
+                if ( stays[j] ) {
+                    continue;
+                }
+                if ( matchB[j] >= 0 ) {
+                    const size_t slot = fromSlot[matchB[j]];
+                    const int from = SlotIndex( tree, slot );
+                    OccupySlot( tree, slot, -1 );
+                    const int to = SlotIndex( tree, toSlot[j] );
+                    OccupySlot( tree, toSlot[j], 1 );
+                    if ( from == to ) {
+                        continue;
+                    }
+                    const size_t mark = PushIndex( from );
+                    XMLElement* op = AddOp( "move" );
+                    PopTo( mark );
+                    op->SetAttribute( "to", _path.Mem() );
+                    op->SetAttribute( "index", to );
+                }
+                else {
+                    const int to = SlotIndex( tree, toSlot[j] );
+                    OccupySlot( tree, toSlot[j], 1 );
+                    XMLElement* op = AddOp( "insert" );
+                    op->SetAttribute( "index", to );
+                    const XMLNode* node = b[j];
+                    if ( node->ToDeclaration() ) {
+                        // Not allowed inside the <insert> element by the parser.
+                        op->SetAttribute( "declaration", node->Value() );
+                    }
+                    else if ( node->ToText() && !node->ToText()->CData() && IsWhiteSpaceOnly( node->Value() ) ) {
+                        // Would be dropped as formatting when the script is parsed.
+                        op->SetAttribute( "text", node->Value() );
+                    }
+                    else {
+                        op->InsertEndChild( node->DeepClone( _script ) );
+                    }
+                }
+            }
+
+            // The children are in 'b' order now; the pairs that differ are
+            // diffed next, first to last.
+            for( size_t j = b.Size(); j-- > 0; ) {
+                if ( matchB[j] >= 0 && !same[j] ) {
+                    XMLDiffWork work = { a[matchB[j]], b[j], static_cast<int>( j ), 0 };
+                    _work.Push( work );
+                }
+            }
+        }
+
+        enum { BUF_SIZE = 32 };
+
+        XMLDocument*        _script;
+        XMLElement*         _root;
+        DynArray<char, 64>  _path;      // "2/0/5", null terminated
+        DynArray<XMLDiffWork, 32> _work;
+    };
+
+
+    void XMLDiff( const XMLDocument& from, const XMLDocument& to, XMLDocument* script )
+    {
+        TIXMLASSERT( script );
+        script->Clear();
+        XMLElement* root = script->NewElement( "diff" );
+        script->InsertEndChild( root );
+        root->SetAttribute( "from", from.Hash() );
+        root->SetAttribute( "to", to.Hash() );
+        XMLDiffer differ( script, root );
+        differ.Diff( &from, &to );
+    }
+
+
+    // The node at 'path' in 'doc', or null.
+    static XMLNode* ResolveDiffPath( XMLDocument* doc, const char* path )
+    {
+        if ( !path ) {
+            return 0;
+        }
+        XMLNode* node = doc;
+        const char* p = path;
+        while ( *p ) {
+            if ( !( *p >= '0' && *p <= '9' ) ) {
+                return 0;
+            }
+            size_t index = 0;
+            while ( *p >= '0' && *p <= '9' ) {
+                index = index * 10 + static_cast<size_t>( *p - '0' );
+                ++p;
+            }
+            if ( *p == '/' ) {
+                ++p;
+                if ( !*p ) {
+                    return 0;
+                }
+            }
+            else if ( *p ) {
+                return 0;
+            }
+            XMLNode* child = node->FirstChild();
+            while ( child && index-- > 0 ) {
+                child = child->NextSibling();
+            }
+            if ( !child ) {
+                return 0;
+            }
+            node = child;
+        }
+        return node;
+    }
+
+    // Make 'node' child 'index' of 'parent', not counting 'node' itself.
+    static bool InsertDiffChild( XMLNode* parent, int index, XMLNode* node )
+    {
+        if ( index < 0 ) {
+            return false;
+        }
+        if ( index == 0 ) {
+            return parent->InsertFirstChild( node ) != 0;
+        }
+        XMLNode* after = parent->FirstChild();
+        for( ;; ) {
+            if ( after == node ) {
+                after = after->NextSibling();
+            }
+            if ( !after || index == 1 ) {
+                break;
+            }
+            after = after->NextSibling();
+            --index;
+        }
+        return after && parent->InsertAfterChild( after, node ) != 0;
+    }
+
+    static bool ApplyDiffOp( XMLDocument* doc, const XMLElement* op )
+    {
+        XMLNode* node = ResolveDiffPath( doc, op->Attribute( "path" ) );
+        if ( !node ) {
+            return false;
+        }
+        const char* name = op->Name();
+        if ( XMLUtil::StringEqual( name, "value" ) ) {
+            const char* value = op->Attribute( "value" );
+            if ( node == doc || !value ) {
+                return false;
+            }
+            node->SetValue( value );
+            return true;
+        }
+        if ( XMLUtil::StringEqual( name, "set" ) || XMLUtil::StringEqual( name, "unset" ) ) {
+            XMLElement* element = node->ToElement();
+            const char* attribute = op->Attribute( "name" );
+            if ( !element || !attribute ) {
+                return false;
+            }
+            if ( name[0] == 's' ) {
+                const char* value = op->Attribute( "value" );
+                if ( !value ) {
+                    return false;
+                }
+                element->SetAttribute( attribute, value );
+            }
+            else {
+                element->DeleteAttribute( attribute );
+            }
+            return true;
+        }
+        if ( XMLUtil::StringEqual( name, "delete" ) ) {
+            if ( node == doc ) {
+                return false;
+            }
+            doc->DeleteNode( node );
+            return true;
+        }
+        int index = -1;
+        if ( op->QueryIntAttribute( "index", &index ) != XML_SUCCESS ) {
+            return false;
+        }
+        if ( XMLUtil::StringEqual( name, "insert" ) ) {
+            XMLNode* child = 0;
+            if ( const char* declaration = op->Attribute( "declaration" ) ) {
+                child = doc->NewDeclaration( declaration );
+            }
+            else if ( const char* text = op->Attribute( "text" ) ) {
+                child = doc->NewText( text );
+            }
+            else if ( op->FirstChild() && !op->FirstChild()->NextSibling() ) {
+                child = op->FirstChild()->DeepClone( doc );
+            }
+            if ( !child ) {
+                return false;
+            }
+            if ( !InsertDiffChild( node, index, child ) ) {
+                doc->DeleteNode( child );
+                return false;
+            }
+            return true;
+        }
+        if ( XMLUtil::StringEqual( name, "move" ) ) {
+            XMLNode* parent = ResolveDiffPath( doc, op->Attribute( "to" ) );
+            if ( !parent || node == doc ) {
+                return false;
+            }
+            for( const XMLNode* p = parent; p; p = p->Parent() ) {
+                if ( p == node ) {
+                    return false;   // into itself
+                }
+            }
+            return InsertDiffChild( parent, index, node );
+        }
+        return false;
+    }
+
+
+    XMLError XMLPatch( XMLDocument* doc, const XMLDocument& script )
+    {
+        TIXMLASSERT( doc );
+        const XMLElement* root = script.RootElement();
+        if ( !root || !XMLUtil::StringEqual( root->Name(), "diff" ) ) {
+            return XML_ERROR_BAD_PATCH;
+        }
+        uint64_t hash = 0;
+        if ( root->QueryUnsigned64Attribute( "from", &hash ) == XML_SUCCESS && doc->Hash() != hash ) {
+            return XML_ERROR_BAD_PATCH;
+        }
+        for( const XMLElement* op = root->FirstChildElement(); op; op = op->NextSiblingElement() ) {
+            if ( !ApplyDiffOp( doc, op ) ) {
+                return XML_ERROR_BAD_PATCH;
+            }
+        }
+        if ( root->QueryUnsigned64Attribute( "to", &hash ) == XML_SUCCESS && doc->Hash() != hash ) {
+            return XML_ERROR_BAD_PATCH;
+        }
+        return XML_SUCCESS;
     }
 
 }   // namespace tinyxml2
@@ -9,6 +9,16 @@
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <string>
+#ifdef TINYXML2_HAS_THREADS
+	#include <chrono>
+	#include <thread>
+	#include <utility>
+#endif
+#ifdef TINYXML2_HAS_POSIX_IO
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
 
 #if defined( _MSC_VER ) || defined (WIN32)
 	#include <crtdbg.h>
@@ -297,6 +307,291 @@ bool example_4()
 */
 
 
+// Allocator that counts, and checks, everything a document asks for.
+class CountingAllocator : public XMLAllocator
+{
+public:
+	CountingAllocator() : allocations( 0 ), liveBytes( 0 ), sizeMismatch( false ) {}
+
+	virtual void* Allocate( size_t size ) {
+		++allocations;
+		liveBytes += size;
+		size_t* mem = static_cast<size_t*>( malloc( size + HEADER ) );
+		*mem = size;
+		return reinterpret_cast<char*>( mem ) + HEADER;
+	}
+	virtual void Deallocate( void* mem, size_t size ) {
+		size_t* base = reinterpret_cast<size_t*>( static_cast<char*>( mem ) - HEADER );
+		sizeMismatch = sizeMismatch || *base != size;
+		liveBytes -= size;
+		free( base );
+	}
+
+	int allocations;
+	size_t liveBytes;
+	bool sizeMismatch;
+
+private:
+	enum { HEADER = 16 };	// keeps the returned memory aligned for any type
+};
+
+// Visitor that counts elements.
+class ElementCounter : public XMLVisitor
+{
+public:
+	ElementCounter() : elements( 0 ) {}
+
+	using XMLVisitor::VisitEnter;
+
+	virtual bool VisitEnter( const XMLElement&, const XMLAttribute* ) {
+		++elements;
+		return true;
+	}
+
+	int elements;
+};
+
+// The same count, dispatched at compile time by Visit().
+struct StaticElementCounter : public XMLStaticVisitor
+{
+	StaticElementCounter() : elements( 0 ) {}
+
+	bool EnterElement( const XMLElement&, const XMLAttribute* ) {
+		++elements;
+		return true;
+	}
+
+	int elements;
+};
+
+// Records the visitor callbacks. An element named "skip" refuses its
+// children, and a text or comment "stop" ends the walk of its siblings.
+struct CallRecord {
+	std::string calls;
+
+	bool Enter( const char* name, bool stop ) {
+		calls += "+";
+		calls += name;
+		calls += " ";
+		return !stop;
+	}
+	bool Exit( const char* name ) {
+		calls += "-";
+		calls += name;
+		calls += " ";
+		return true;
+	}
+	bool Leaf( const char* kind, const char* value ) {
+		calls += kind;
+		calls += value;
+		calls += " ";
+		return strcmp( value, "stop" ) != 0;
+	}
+};
+
+class RecordingVisitor : public XMLVisitor
+{
+public:
+	virtual bool VisitEnter( const XMLDocument& )								{ return record.Enter( "#doc", false ); }
+	virtual bool VisitExit( const XMLDocument& )								{ return record.Exit( "#doc" ); }
+	virtual bool VisitEnter( const XMLElement& e, const XMLAttribute* )		{ return record.Enter( e.Name(), XMLUtil::StringEqual( e.Name(), "skip" ) ); }
+	virtual bool VisitExit( const XMLElement& e )								{ return record.Exit( e.Name() ); }
+	virtual bool Visit( const XMLDeclaration& d )								{ return record.Leaf( "?", d.Value() ); }
+	virtual bool Visit( const XMLText& t )										{ return record.Leaf( "t:", t.Value() ); }
+	virtual bool Visit( const XMLComment& c )									{ return record.Leaf( "c:", c.Value() ); }
+	virtual bool Visit( const XMLUnknown& u )									{ return record.Leaf( "!", u.Value() ); }
+
+	CallRecord record;
+};
+
+struct StaticRecordingVisitor : public XMLStaticVisitor
+{
+	bool EnterDocument( const XMLDocument& )									{ return record.Enter( "#doc", false ); }
+	bool ExitDocument( const XMLDocument& )										{ return record.Exit( "#doc" ); }
+	bool EnterElement( const XMLElement& e, const XMLAttribute* )				{ return record.Enter( e.Name(), XMLUtil::StringEqual( e.Name(), "skip" ) ); }
+	bool ExitElement( const XMLElement& e )										{ return record.Exit( e.Name() ); }
+	bool VisitDeclaration( const XMLDeclaration& d )							{ return record.Leaf( "?", d.Value() ); }
+	bool VisitText( const XMLText& t )											{ return record.Leaf( "t:", t.Value() ); }
+	bool VisitComment( const XMLComment& c )									{ return record.Leaf( "c:", c.Value() ); }
+	bool VisitUnknown( const XMLUnknown& u )									{ return record.Leaf( "!", u.Value() ); }
+
+	CallRecord record;
+};
+
+// Printer that takes all of its output through the virtual hooks.
+class CapturingPrinter : public XMLPrinter
+{
+public:
+	CapturingPrinter( bool useTabs=false ) : length( 0 ), tabs( useTabs ) { text[0] = 0; }
+
+	char text[4096];
+	size_t length;
+
+protected:
+	virtual void Write( const char* data, size_t size ) {
+		for ( size_t i = 0; i < size; ++i ) {
+			Putc( data[i] );
+		}
+	}
+	virtual void Putc( char ch ) {
+		if ( length + 1 < sizeof( text ) ) {
+			text[length++] = ch;
+			text[length] = 0;
+		}
+	}
+	virtual void PrintSpace( int depth ) {
+		if ( !tabs ) {
+			XMLPrinter::PrintSpace( depth );
+			return;
+		}
+		for ( int i = 0; i < depth; ++i ) {
+			Putc( '\t' );
+		}
+	}
+
+private:
+	bool tabs;
+};
+
+// Output sink callback: records how the printer chunked its output.
+struct SinkRecord {
+	SinkRecord() : calls( 0 ), largest( 0 ), fail( false ) {}
+
+	std::string text;
+	int calls;
+	size_t largest;
+	bool fail;
+};
+
+static bool RecordChunk( const char* data, size_t size, void* userData )
+{
+	SinkRecord* record = static_cast<SinkRecord*>( userData );
+	record->text.append( data, size );
+	++record->calls;
+	if ( size > record->largest ) {
+		record->largest = size;
+	}
+	return !record->fail;
+}
+
+// Random small trees for the diff round trips: few words, so siblings
+// repeat and names meet values that differ in one letter.
+static unsigned NextRandom( unsigned* seed )
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return ( *seed >> 8 ) & 0xffff;
+}
+
+static void RandomChildren( XMLDocument* doc, XMLNode* parent, unsigned* seed, int depth )
+{
+	static const char* words[] = { "item", "htem", "jtem", "a", "b", "c" };
+	static const unsigned WORDS = sizeof( words ) / sizeof( words[0] );
+	const unsigned children = NextRandom( seed ) % 4;
+	for ( unsigned i = 0; i < children; ++i ) {
+		const char* word = words[NextRandom( seed ) % WORDS];
+		switch ( NextRandom( seed ) % 4 ) {
+			case 0:
+				parent->InsertEndChild( doc->NewText( word ) );
+				break;
+			case 1:
+				parent->InsertEndChild( doc->NewComment( word ) );
+				break;
+			default: {
+				XMLElement* element = doc->NewElement( word );
+				if ( NextRandom( seed ) % 3 == 0 ) {
+					element->SetAttribute( words[NextRandom( seed ) % WORDS], words[NextRandom( seed ) % WORDS] );
+				}
+				parent->InsertEndChild( element );
+				if ( depth > 0 ) {
+					RandomChildren( doc, element, seed, depth - 1 );
+				}
+				break;
+			}
+		}
+	}
+}
+
+#ifdef TINYXML2_HAS_THREADS
+// Forks of one finalized template, one per request, as request handlers
+// would make them.
+static void ForkRequests( const XMLDocument* templ, const std::string* expected, std::atomic<int>* failures )
+{
+	for ( int i = 0; i < 20; ++i ) {
+		XMLDocument fork;
+		templ->DeepCopy( &fork );
+		fork.RootElement()->SetAttribute( "request", i );
+		fork.RootElement()->DeleteAttribute( "request" );
+		XMLPrinter printer;
+		fork.Print( &printer );
+		if ( *expected != printer.CStr() || !fork.DeepEqual( templ ) ) {
+			++*failures;
+		}
+	}
+}
+
+// Request handler loop for the document pool test.
+static void PooledRequests( XMLDocumentPool* pool, int requests, std::atomic<int>* failures )
+{
+	for ( int i = 0; i < requests; ++i ) {
+		XMLDocumentPool::Handle doc = pool->Acquire();
+		if ( doc->FirstChild() || doc->Error() ) {
+			++*failures;		// not cleared
+		}
+		doc->Parse( "<request id='7'><body>payload</body></request>" );
+		if ( doc->Error() || doc->RootElement()->IntAttribute( "id" ) != 7 ) {
+			++*failures;
+		}
+	}
+}
+
+// Pins versions of a persistent document as they are published, and
+// checks each is complete: the count on the root matches its children.
+static void PersistentReader( const XMLPersistentDocument* config, const std::atomic<bool>* stop, std::atomic<int>* failures )
+{
+	uint64_t last = 0;
+	while ( !*stop ) {
+		XMLPersistentDocument::Version version = config->Pin();
+		if ( version.Number() < last ) {
+			++*failures;
+		}
+		last = version.Number();
+		const XMLElement* root = version->RootElement();
+		int items = 0;
+		for ( const XMLElement* item = root->FirstChildElement( "item" ); item; item = item->NextSiblingElement( "item" ) ) {
+			if ( item->IntAttribute( "n", -1 ) != items ) {
+				++*failures;
+			}
+			++items;
+		}
+		if ( items != root->IntAttribute( "items" ) ) {
+			++*failures;
+		}
+	}
+}
+
+// Reads a finalized document shared with other threads.
+static void SharedReader( const XMLDocument* doc, const XMLDocument* reference, const std::string* expected, std::atomic<int>* failures )
+{
+	for ( int i = 0; i < 5; ++i ) {
+		XMLPrinter printer;
+		doc->Print( &printer );
+		if ( *expected != printer.CStr() ) {
+			++*failures;
+		}
+		const XMLElement* title = doc->RootElement()->FirstChildElement( "TITLE" );
+		if ( !title || strcmp( title->GetText(), "A Midsummer Night's Dream" ) != 0 ) {
+			++*failures;
+		}
+		if ( !doc->DeepEqual( reference ) ) {
+			++*failures;
+		}
+		if ( strcmp( doc->ErrorStr(), "Error=XML_SUCCESS ErrorID=0 (0x0) Line number=0" ) != 0 ) {
+			++*failures;
+		}
+	}
+}
+#endif
+
 int main( int argc, const char ** argv )
 {
 	#if defined( _MSC_VER ) && defined( TINYXML2_DEBUG )
@@ -578,6 +873,8 @@ int main( int argc, const char ** argv )
 		XMLTest("Formatted error string",
 			"Error=XML_ERROR_PARSING_ATTRIBUTE ErrorID=7 (0x7) Line number=3: XMLElement name=wrong",
 			errorStr);
+		doc.Parse( "<ok/>" );
+		XMLTest( "Success error string", "Error=XML_SUCCESS ErrorID=0 (0x0) Line number=0", doc.ErrorStr() );
 	}
 
 	{
@@ -1642,7 +1939,7 @@ int main( int argc, const char ** argv )
 
 		static const char* result  = "\xef\xbb\xbf<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
 		XMLTest( "BOM and default declaration", result, printer.CStr(), false );
-		XMLTest( "CStrSize", 42, printer.CStrSize(), false );
+		XMLTest( "CStrSize", size_t( 42 ), printer.CStrSize(), false );
 	}
 	{
 		const char* xml = "<ipxml ws='1'><info bla=' /></ipxml>";
@@ -2488,6 +2785,1434 @@ int main( int argc, const char ** argv )
     	doc.PrintError();
     }
 
+    // ----------- Binary snapshots --------------
+    {
+        XMLDocument doc;
+        doc.LoadFile( "resources/dream.xml" );
+        XMLTest( "Snapshot: load source", false, doc.Error() );
+        XMLPrinter original;
+        doc.Print( &original );
+
+        XMLTest( "Snapshot: save", XML_SUCCESS, doc.SaveSnapshot( "resources/out/dream.snapshot" ) );
+
+        XMLDocument loaded;
+        XMLTest( "Snapshot: load file", XML_SUCCESS, loaded.LoadSnapshot( "resources/out/dream.snapshot" ) );
+        XMLPrinter restored;
+        loaded.Print( &restored );
+        XMLTest( "Snapshot: file round trip", original.CStr(), restored.CStr() );
+        XMLTest( "Snapshot: line numbers kept", doc.FirstChildElement()->GetLineNum(), loaded.FirstChildElement()->GetLineNum() );
+    }
+    {
+        const char* xml = "<?xml version='1.0'?><root a='1' b='&amp;'><sub/><![CDATA[x<y]]>t&lt;<!--c--><!u></root>";
+        XMLDocument doc;
+        doc.Parse( xml );
+
+        FILE* snapshotFile = fopen( "resources/out/small.snapshot", "wb" );
+        doc.SaveSnapshot( snapshotFile );
+        fclose( snapshotFile );
+
+        snapshotFile = fopen( "resources/out/small.snapshot", "rb" );
+        char image[1024];
+        const size_t size = fread( image, 1, sizeof( image ), snapshotFile );
+        fclose( snapshotFile );
+
+        XMLDocument loaded;
+        XMLTest( "Snapshot: load memory", XML_SUCCESS, loaded.LoadSnapshot( image, size ) );
+        XMLPrinter p0, p1;
+        doc.Print( &p0 );
+        loaded.Print( &p1 );
+        XMLTest( "Snapshot: memory round trip", p0.CStr(), p1.CStr() );
+        XMLTest( "Snapshot: attribute value", "&", loaded.RootElement()->Attribute( "b" ) );
+        XMLTest( "Snapshot: cdata", true, loaded.RootElement()->FirstChild()->NextSibling()->ToText()->CData() );
+
+        XMLTest( "Snapshot: truncated", XML_ERROR_PARSING, loaded.LoadSnapshot( image, size - 1 ) );
+        XMLTest( "Snapshot: truncated leaves empty doc", true, loaded.FirstChild() == 0 );
+        image[0] = 'X';
+        XMLTest( "Snapshot: bad magic", XML_ERROR_PARSING, loaded.LoadSnapshot( image, size ) );
+
+        // A device that is always full fails the writes.
+        FILE* full = fopen( "/dev/full", "wb" );
+        if ( full ) {
+            XMLTest( "Snapshot: write error", XML_ERROR_FILE_WRITE_ERROR, doc.SaveSnapshot( full ) );
+            fclose( full );
+            XMLTest( "Snapshot: write error on close", XML_ERROR_FILE_WRITE_ERROR, doc.SaveSnapshot( "/dev/full" ) );
+        }
+    }
+
+    // ----------- Allocator --------------
+    {
+        CountingAllocator allocator;
+        {
+            XMLDocument doc;
+            doc.SetAllocator( &allocator );
+            XMLTest( "Allocator: set", true, doc.Allocator() == &allocator );
+            doc.LoadFile( "resources/dream.xml" );
+            XMLTest( "Allocator: parse", false, doc.Error() );
+            XMLTest( "Allocator: used", true, allocator.allocations > 0 );
+
+            // Owned strings, array growth, errors and clones.
+            XMLElement* root = doc.RootElement();
+            root->SetAttribute( "owned", "a string the document has to copy" );
+            root->SetValue( "RENAMED" );
+            for ( int i = 0; i < 100; ++i ) {
+                doc.NewElement( "unlinked" );
+            }
+            XMLDocument copy;
+            copy.SetAllocator( &allocator );
+            doc.DeepCopy( &copy );
+            XMLTest( "Allocator: copy", "RENAMED", copy.RootElement()->Name() );
+            copy.Parse( "<a><b></a>" );
+            XMLTest( "Allocator: error", XML_ERROR_MISMATCHED_ELEMENT, copy.ErrorID() );
+
+            doc.SetAllocator( 0 );
+            XMLTest( "Allocator: reset to default", true, doc.Allocator() == XMLAllocator::Default() );
+            XMLTest( "Allocator: reset clears", true, doc.FirstChild() == 0 );
+            doc.Parse( "<default/>" );
+        }
+        XMLTest( "Allocator: all memory returned", true, allocator.liveBytes == 0 );
+        XMLTest( "Allocator: sizes match", false, allocator.sizeMismatch );
+    }
+
+    // ----------- String arena --------------
+    {
+        CountingAllocator heapStrings;
+        CountingAllocator arenaStrings;
+        CountingAllocator* allocators[2] = { &heapStrings, &arenaStrings };
+        const char* printed[2] = { 0, 0 };
+        size_t liveAfterClear[2] = { 0, 0 };
+        XMLPrinter printers[2];
+        for ( int pass = 0; pass < 2; ++pass ) {
+            XMLDocument doc;
+            doc.SetAllocator( allocators[pass] );
+            doc.SetStringArena( pass == 1 );
+            XMLElement* root = doc.NewElement( "response" );
+            doc.InsertEndChild( root );
+            for ( int i = 0; i < 1000; ++i ) {
+                XMLElement* item = root->InsertNewChildElement( "item" );
+                item->SetAttribute( "id", i );
+                item->SetAttribute( "name", "a reasonably long attribute value" );
+                item->SetText( "text" );
+                item->SetName( "entry" );
+            }
+            // One string larger than a chunk.
+            char big[10000];
+            memset( big, 'x', sizeof( big ) - 1 );
+            big[sizeof( big ) - 1] = 0;
+            root->SetAttribute( "big", big );
+            doc.Print( &printers[pass] );
+            printed[pass] = printers[pass].CStr();
+
+            doc.Clear();
+            liveAfterClear[pass] = allocators[pass]->liveBytes;
+        }
+        // Heap strings make Clear() delete node by node and keep the pool
+        // blocks; with the arena the blocks and chunks are released
+        // wholesale, only the bookkeeping arrays stay.
+        XMLTest( "String arena: released on Clear", true, liveAfterClear[1] * 10 < liveAfterClear[0] );
+        XMLTest( "String arena: all memory returned", true, arenaStrings.liveBytes == 0 && !arenaStrings.sizeMismatch );
+        XMLTest( "String arena: same document", printed[0], printed[1], false );
+        printf( "String arena: %d allocations, %d without the arena\n", arenaStrings.allocations, heapStrings.allocations );
+        XMLTest( "String arena: fewer allocations", true, arenaStrings.allocations * 10 < heapStrings.allocations );
+    }
+
+    // ----------- Unlinked node tracking --------------
+    {
+        // Creating many nodes before linking them must stay linear.
+        static const int COUNT = 1000000;
+        XMLDocument doc;
+        XMLElement** detached = new XMLElement*[COUNT];
+        const clock_t cstart = clock();
+        for ( int i = 0; i < COUNT; ++i ) {
+            detached[i] = doc.NewElement( "e" );
+        }
+        // Delete every 4th node while unlinked, attach the rest.
+        XMLElement* root = doc.NewElement( "root" );
+        doc.InsertEndChild( root );
+        int attached = 0;
+        for ( int i = 0; i < COUNT; ++i ) {
+            if ( i % 4 == 0 ) {
+                doc.DeleteNode( detached[i] );
+            }
+            else {
+                root->InsertEndChild( detached[i] );
+                ++attached;
+            }
+        }
+        const clock_t cend = clock();
+        delete [] detached;
+
+        int children = 0;
+        for ( const XMLNode* node = root->FirstChild(); node; node = node->NextSibling() ) {
+            ++children;
+        }
+        XMLTest( "Unlinked nodes: attached", attached, children );
+        printf( "Unlinked nodes: %d created, deleted and attached in %.3f milli-seconds\n",
+                COUNT, 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC );
+
+        // Deleting unlinked nodes in any order leaves the rest tracked.
+        XMLNode* a = doc.NewElement( "a" );
+        XMLNode* b = doc.NewElement( "b" );
+        XMLNode* c = doc.NewElement( "c" );
+        doc.DeleteNode( a );
+        root->InsertFirstChild( c );
+        doc.DeleteNode( b );
+        XMLTest( "Unlinked nodes: out of order", "c", root->FirstChild()->Value() );
+    }
+
+    // ----------- Reuse mode --------------
+    {
+        CountingAllocator allocator;
+        XMLDocument doc;
+        doc.SetAllocator( &allocator );
+        doc.SetReuseMode( true );
+        XMLTest( "Reuse mode: set", true, doc.ReuseMode() );
+
+        // A tiny message fits the inline buffer: nothing but the first
+        // pool blocks is ever allocated.
+        char tiny[] = "<msg id='0'><a>0</a><!--c--></msg>";
+        doc.Parse( tiny );
+        const int tinyWarm = allocator.allocations;
+        for ( int i = 0; i < 1000; ++i ) {
+            tiny[9] = char( '0' + i % 10 );
+            tiny[15] = char( '0' + i % 7 );
+            doc.Parse( tiny );
+        }
+        XMLTest( "Reuse mode: tiny messages", tinyWarm, allocator.allocations );
+        XMLTest( "Reuse mode: tiny content", 9, doc.RootElement()->IntAttribute( "id" ) );
+
+        // Larger messages reuse the heap buffer and the blocks.
+        XMLPrinter batch;
+        batch.OpenElement( "batch" );
+        for ( int i = 0; i < 50; ++i ) {
+            batch.OpenElement( "item" );
+            batch.PushAttribute( "n", i );
+            batch.PushText( "value" );
+            batch.CloseElement();
+        }
+        batch.CloseElement();
+        char message[4096];
+        strcpy( message, batch.CStr() );
+        doc.Parse( message );
+        doc.Parse( message );
+        const int warm = allocator.allocations;
+        for ( int i = 0; i < 1000; ++i ) {
+            message[21] = char( '0' + i % 10 );     // same shape, different content
+            doc.Parse( message );
+        }
+        XMLTest( "Reuse mode: steady state allocates nothing", warm, allocator.allocations );
+        XMLTest( "Reuse mode: content", false, doc.Error() );
+
+        doc.SetReuseMode( false );
+        doc.Clear();
+        XMLTest( "Reuse mode: off releases the buffers", true, allocator.liveBytes < 4096 );
+    }
+
+#ifdef TINYXML2_HAS_THREADS
+    // ----------- Document pool --------------
+    {
+        XMLDocumentPool pool( 8 );
+        XMLDocument* first = 0;
+        {
+            XMLDocumentPool::Handle doc = pool.Acquire();
+            first = doc.Get();
+            doc->Parse( "<a/>" );
+            XMLTest( "Document pool: reuse mode", true, doc->ReuseMode() );
+        }
+        {
+            XMLDocumentPool::Handle doc = pool.Acquire();
+            XMLTest( "Document pool: thread cache hit", true, doc.Get() == first );
+            XMLTest( "Document pool: cleared", true, doc->FirstChild() == 0 );
+            XMLDocumentPool::Handle moved( std::move( doc ) );
+            XMLTest( "Document pool: moved", true, doc.Get() == 0 && moved.Get() == first );
+        }
+
+        // More documents than the thread cache holds spill to the shared list.
+        {
+            XMLDocumentPool::Handle docs[XMLDocumentPool::LOCAL_CACHE_SIZE + 20];
+            for ( int i = 0; i < XMLDocumentPool::LOCAL_CACHE_SIZE + 20; ++i ) {
+                docs[i] = pool.Acquire();
+            }
+        }
+        XMLTest( "Document pool: bounded spill", true, pool.SpillSize() == 8 );
+
+        static const int THREADS = 8;
+        static const int REQUESTS = 20000;
+        std::atomic<int> failures( 0 );
+        std::thread threads[THREADS];
+        const clock_t cstart = clock();
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i] = std::thread( PooledRequests, &pool, REQUESTS, &failures );
+        }
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i].join();
+        }
+        const clock_t cend = clock();
+        XMLTest( "Document pool: threaded requests", 0, failures.load() );
+        XMLTest( "Document pool: spill after threads", true, pool.SpillSize() <= 8 );
+        printf( "Document pool: %d requests on %d threads in %.3f cpu milli-seconds\n", THREADS * REQUESTS, THREADS,
+                1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC );
+
+        // A pool destroyed by another thread: this thread's cache frees the
+        // documents it holds for it, and its slot serves other pools. (A
+        // thread caches for four pools; 'pool' has one slot already.)
+        XMLDocumentPool* gone = new XMLDocumentPool( 8 );
+        gone->Acquire();
+        std::thread( [gone]() { delete gone; } ).join();
+        XMLDocumentPool others[3];
+        bool cached = true;
+        for ( int i = 0; i < 3; ++i ) {
+            others[i].Acquire();
+            cached = cached && others[i].SpillSize() == 0;
+        }
+        XMLTest( "Document pool: slot of a destroyed pool reused", true, cached );
+    }
+
+    // ----------- Parallel printing --------------
+    {
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        const char* docs[] = {
+            0,      // dream.xml
+            "<a><b><c><d x='1'>&amp;</d><!--c--><e/><f><g>t</g>text<h/></f><!--end--></c></b></a>",
+            "<?xml version='1.0'?>\n<!--top--><r><s/>mixed<t/></r>",
+            "<only/>",
+        };
+        for ( int d = 0; d < 4; ++d ) {
+            XMLDocument parsed;
+            if ( docs[d] ) {
+                parsed.Parse( docs[d] );
+            }
+            const XMLDocument& doc = docs[d] ? parsed : dream;
+            for ( int compact = 0; compact < 2; ++compact ) {
+                XMLPrinter sequential( 0, compact != 0 );
+                doc.Print( &sequential );
+
+                std::string out;
+                XMLStringSink< std::string > sink( &out );
+                XMLParallelPrinter parallel( 3, compact != 0 );
+                XMLTest( "Parallel print: ok", true, parallel.Print( doc, sink ) );
+                XMLTest( "Parallel print: identical", sequential.CStr(), out.c_str(), false );
+                if ( d < 2 ) {
+                    XMLTest( "Parallel print: split", true, parallel.Chunks() > 1 );
+                }
+                if ( d == 2 ) {
+                    XMLTest( "Parallel print: mixed content is sequential", 0, parallel.Chunks() );
+                }
+            }
+        }
+
+        XMLDocument raw( false );
+        raw.Parse( "<a><b>&lt;</b><c>&amp;amp;</c></a>" );
+        XMLPrinter sequential;
+        raw.Print( &sequential );
+        std::string out;
+        XMLStringSink< std::string > sink( &out );
+        XMLParallelPrinter parallel( 2 );
+        parallel.Print( raw, sink );
+        XMLTest( "Parallel print: entities untouched", sequential.CStr(), out.c_str() );
+        XMLTest( "Parallel print: split without entities", 2, parallel.Chunks() );
+    }
+
+    // ----------- Async save --------------
+    {
+        struct Slurp {
+            static std::string File( const char* path ) {
+                std::string str;
+                FILE* fp = fopen( path, "rb" );
+                if ( fp ) {
+                    char buf[4096];
+                    size_t n = 0;
+                    while ( ( n = fread( buf, 1, sizeof( buf ), fp ) ) > 0 ) {
+                        str.append( buf, n );
+                    }
+                    fclose( fp );
+                }
+                return str;
+            }
+        };
+
+        // Several sink buffers worth of output, through a ring of one
+        // and of two buffers.
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        XMLDocument* doc = new XMLDocument();
+        XMLElement* root = doc->NewElement( "library" );
+        doc->InsertEndChild( root );
+        for ( int i = 0; i < 8; ++i ) {
+            root->InsertEndChild( dream.RootElement()->DeepClone( doc ) );
+        }
+        XMLPrinter expected;
+        doc->Print( &expected );
+        XMLTest( "Async save: several buffers", true, expected.CStrSize() > 4 * XMLPrinter::SINK_BUFFER_SIZE );
+
+        for ( int buffers = 1; buffers <= 2; ++buffers ) {
+            XMLAsyncSave save = doc->SaveFileAsync( "resources/out/async.xml", false, buffers );
+            XMLTest( "Async save: result", XML_SUCCESS, save.Wait() );
+            XMLTest( "Async save: done", true, save.Done() );
+            XMLTest( "Async save: wait again", XML_SUCCESS, save.Wait() );
+            XMLTest( "Async save: content", true, Slurp::File( "resources/out/async.xml" ) == expected.CStr() );
+        }
+
+        // The document is printed by the time SaveFileAsync() returns.
+        XMLAsyncSave pending = doc->SaveFileAsync( "resources/out/async.xml", true );
+        XMLPrinter compact( 0, true );
+        doc->Print( &compact );
+        delete doc;
+        XMLAsyncSave moved( std::move( pending ) );
+        XMLTest( "Async save: moved from", XML_SUCCESS, pending.Wait() );
+        XMLTest( "Async save: after delete", XML_SUCCESS, moved.Wait() );
+        XMLTest( "Async save: compact content", true, Slurp::File( "resources/out/async.xml" ) == compact.CStr() );
+
+        XMLAsyncSave none;
+        XMLTest( "Async save: empty handle", true, none.Done() );
+        XMLTest( "Async save: empty handle result", XML_SUCCESS, none.Wait() );
+
+        XMLAsyncSave bad = dream.SaveFileAsync( "resources/no-such-dir/async.xml" );
+        XMLTest( "Async save: open error", XML_ERROR_FILE_COULD_NOT_BE_OPENED, bad.Wait() );
+        XMLTest( "Async save: document error untouched", false, dream.Error() );
+#if defined( __linux__ )
+        XMLAsyncSave full = dream.SaveFileAsync( "/dev/full" );
+        XMLTest( "Async save: write error", XML_ERROR_FILE_WRITE_ERROR, full.Wait() );
+#endif
+    }
+
+    // ----------- Shared readers --------------
+    {
+        // What the readers should see, from a document of its own.
+        XMLDocument reference;
+        reference.LoadFile( "resources/dream.xml" );
+        XMLPrinter printer;
+        reference.Print( &printer );
+        const std::string expected = printer.CStr();
+        const uint64_t hash = reference.Hash();
+
+        XMLDocument shared;
+        shared.LoadFile( "resources/dream.xml" );
+        shared.FinalizeStrings( 4 );
+        XMLTest( "Shared readers: hash filled", true, shared.Hash() == hash );
+
+        static const int THREADS = 4;
+        std::atomic<int> failures( 0 );
+        std::thread threads[THREADS];
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i] = std::thread( SharedReader, &shared, &reference, &expected, &failures );
+        }
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i].join();
+        }
+        XMLTest( "Shared readers: consistent", 0, failures.load() );
+
+        // Forks of the finalized document only count references to its
+        // strings, so any number of threads can make them at once.
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i] = std::thread( ForkRequests, &shared, &expected, &failures );
+        }
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i].join();
+        }
+        XMLTest( "Shared readers: concurrent forks", 0, failures.load() );
+        XMLDocument fork;
+        shared.DeepCopy( &fork );
+        XMLTest( "Shared readers: fork shares strings", true, fork.RootElement()->Name() == shared.RootElement()->Name() );
+
+        // Entities, whitespace collapsing and a document without a split.
+        XMLDocument collapsed( true, COLLAPSE_WHITESPACE );
+        collapsed.Parse( "<a>\n  one  &amp;\r\n two <b x='&lt;1&gt;'/></a>" );
+        collapsed.FinalizeStrings( 0 );
+        XMLTest( "Shared readers: collapsed", "one & two", collapsed.RootElement()->GetText() );
+        XMLTest( "Shared readers: attribute", "<1>", collapsed.RootElement()->FirstChildElement()->Attribute( "x" ) );
+        XMLDocument single;
+        single.Parse( "<only/>" );
+        single.FinalizeStrings( 8 );
+        XMLTest( "Shared readers: single element", "only", single.RootElement()->Name() );
+    }
+
+    // ----------- Persistent document --------------
+    {
+        XMLPersistentDocument config;
+        XMLTest( "Persistent: nothing published", true, config.Pin().Get() == 0 );
+        config.Document()->Parse( "<config><a v='1'/><b>text</b></config>" );
+        XMLTest( "Persistent: first version", 1, (int)config.Publish() );
+        XMLPersistentDocument::Version v1 = config.Pin();
+        XMLTest( "Persistent: pinned", 1, (int)v1.Number() );
+        XMLTest( "Persistent: content", 1, v1->RootElement()->FirstChildElement( "a" )->IntAttribute( "v" ) );
+        XMLTest( "Persistent: strings shared", true,
+                 v1->RootElement()->FirstChildElement( "b" )->GetText() == config.Document()->RootElement()->FirstChildElement( "b" )->GetText() );
+
+        // Edits show up in the next version only.
+        config.Document()->RootElement()->FirstChildElement( "a" )->SetAttribute( "v", 2 );
+        XMLTest( "Persistent: unpublished edit", 1, v1->RootElement()->FirstChildElement( "a" )->IntAttribute( "v" ) );
+        XMLTest( "Persistent: second version", 2, (int)config.Publish() );
+        XMLPersistentDocument::Version v2 = config.Pin();
+        XMLTest( "Persistent: new content", 2, v2->RootElement()->FirstChildElement( "a" )->IntAttribute( "v" ) );
+        XMLTest( "Persistent: old content", 1, v1->RootElement()->FirstChildElement( "a" )->IntAttribute( "v" ) );
+        XMLTest( "Persistent: hash carried", true, v2->Hash() == config.Document()->Hash() );
+        XMLTest( "Persistent: equal to writer", true, v2->DeepEqual( config.Document() ) );
+
+        // Old versions live as long as they are pinned.
+        XMLTest( "Persistent: old version pinned", 1, (int)config.Reclaim() );
+        XMLPersistentDocument::Version moved( std::move( v1 ) );
+        XMLTest( "Persistent: moved pin", true, v1.Get() == 0 && moved.Number() == 1 );
+        const XMLDocument* first = moved.Get();
+        moved.Release();
+        XMLTest( "Persistent: old version freed", 0, (int)config.Reclaim() );
+
+        // The next version is the unpinned old one, patched up to the
+        // writer's document.
+        config.Document()->RootElement()->FirstChildElement( "b" )->SetText( "patched" );
+        config.Document()->RootElement()->InsertNewChildElement( "c" )->SetAttribute( "new", true );
+        config.Publish();
+        XMLPersistentDocument::Version v3 = config.Pin();
+        XMLTest( "Persistent: old version reused", true, v3.Get() == first );
+        XMLTest( "Persistent: patched content", "patched", v3->RootElement()->FirstChildElement( "b" )->GetText() );
+        XMLTest( "Persistent: patched equal to writer", true, v3->DeepEqual( config.Document() ) );
+        XMLTest( "Persistent: patched hash", true, v3->Hash() == config.Document()->Hash() );
+        XMLTest( "Persistent: pinned version kept", 2, (int)v2->RootElement()->FirstChildElement( "a" )->IntAttribute( "v" ) );
+        v3.Release();
+        XMLTest( "Persistent: current version pinned", 1, (int)config.Reclaim() );
+        v2.Release();
+        XMLTest( "Persistent: all old versions freed", 0, (int)config.Reclaim() );
+
+        // Readers pin while the writer publishes; every version they
+        // see is complete.
+        static const int THREADS = 4;
+        std::atomic<int> failures( 0 );
+        std::atomic<bool> stop( false );
+        std::thread threads[THREADS];
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i] = std::thread( PersistentReader, &config, &stop, &failures );
+        }
+        XMLElement* root = config.Document()->RootElement();
+        for ( int i = 0; i < 200; ++i ) {
+            XMLElement* item = config.Document()->NewElement( "item" );
+            item->SetAttribute( "n", i );
+            root->InsertEndChild( item );
+            root->SetAttribute( "items", i + 1 );
+            config.Publish();
+        }
+        stop = true;
+        for ( int i = 0; i < THREADS; ++i ) {
+            threads[i].join();
+        }
+        XMLTest( "Persistent: readers saw whole versions", 0, failures.load() );
+        XMLTest( "Persistent: reclaimed after readers", 0, (int)config.Reclaim() );
+    }
+#endif
+
+#ifdef TINYXML2_HAS_ZLIB
+    // ----------- gzip --------------
+    {
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        for ( int compact = 0; compact < 2; ++compact ) {
+            XMLPrinter expected( 0, compact != 0 );
+            dream.Print( &expected );
+            const int level = compact ? 1 : 9;
+            XMLTest( "gzip: save", XML_SUCCESS, dream.SaveFileCompressed( "resources/out/dream.xml.gz", level, compact != 0 ) );
+
+            FILE* gzFile = fopen( "resources/out/dream.xml.gz", "rb" );
+            const int magic0 = gzFile ? fgetc( gzFile ) : EOF;
+            const int magic1 = gzFile ? fgetc( gzFile ) : EOF;
+            fseek( gzFile, 0, SEEK_END );
+            const long compressed = ftell( gzFile );
+            fclose( gzFile );
+            XMLTest( "gzip: magic", true, magic0 == 0x1f && magic1 == 0x8b );
+            XMLTest( "gzip: smaller", true, compressed > 0 && (size_t)compressed < expected.CStrSize() / 2 );
+
+            XMLDocument loaded;
+            XMLTest( "gzip: load", XML_SUCCESS, loaded.LoadFile( "resources/out/dream.xml.gz" ) );
+            XMLPrinter printed( 0, compact != 0 );
+            loaded.Print( &printed );
+            XMLTest( "gzip: round trip", expected.CStr(), printed.CStr(), false );
+        }
+
+        // Two members, chained through XMLGzipSink: the second one is
+        // tiny, so the size in the trailer is far too small and the parse
+        // buffer has to grow.
+        std::string gz;
+        XMLStringSink< std::string > str( &gz );
+        {
+            XMLGzipSink gzip( str );
+            gzip.Write( "<library>", 9 );
+            XMLPrinter printer( gzip );
+            dream.RootElement()->Accept( &printer );
+            XMLTest( "gzip: flush", true, printer.Flush() );
+            XMLTest( "gzip: finish", true, gzip.Finish() );
+            XMLTest( "gzip: finished", false, gzip.Write( "x", 1 ) );
+        }
+        {
+            XMLGzipSink gzip( str, 6 );
+            gzip.Write( "</library>", 10 );
+            // Finished by the destructor.
+        }
+        FILE* gzFile = fopen( "resources/out/members.xml.gz", "wb" );
+        fwrite( gz.data(), 1, gz.size(), gzFile );
+        fclose( gzFile );
+        XMLDocument members;
+        members.SetReuseMode( true );
+        XMLTest( "gzip: members", XML_SUCCESS, members.LoadFile( "resources/out/members.xml.gz" ) );
+        XMLPrinter dreamRoot;
+        dream.RootElement()->Accept( &dreamRoot );
+        XMLPrinter membersRoot;
+        members.RootElement()->FirstChildElement()->Accept( &membersRoot );
+        XMLTest( "gzip: members content", dreamRoot.CStr(), membersRoot.CStr(), false );
+        XMLTest( "gzip: reload", XML_SUCCESS, members.LoadFile( "resources/out/members.xml.gz" ) );
+        XMLTest( "gzip: reload content", "library", members.RootElement()->Name() );
+
+        gzFile = fopen( "resources/out/truncated.xml.gz", "wb" );
+        fwrite( gz.data(), 1, gz.size() - 12, gzFile );
+        fclose( gzFile );
+        XMLDocument truncated;
+        XMLTest( "gzip: truncated", XML_ERROR_FILE_READ_ERROR, truncated.LoadFile( "resources/out/truncated.xml.gz" ) );
+
+        gzFile = fopen( "resources/out/corrupt.xml.gz", "wb" );
+        gz[20] = (char)~gz[20];
+        gz[21] = (char)~gz[21];
+        fwrite( gz.data(), 1, gz.size(), gzFile );
+        fclose( gzFile );
+        XMLDocument corrupt;
+        XMLTest( "gzip: corrupt", XML_ERROR_FILE_READ_ERROR, corrupt.LoadFile( "resources/out/corrupt.xml.gz" ) );
+
+        XMLTest( "gzip: open error", XML_ERROR_FILE_COULD_NOT_BE_OPENED, dream.SaveFileCompressed( "resources/no-such-dir/dream.xml.gz" ) );
+    }
+#endif
+
+    // ----------- Serialized size --------------
+    {
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        XMLDocument utf8;
+        utf8.LoadFile( "resources/utf8test.xml" );
+        XMLDocument mixed;
+        mixed.Parse( "<?xml version='1.0'?><!DOCTYPE x><!--c--><r a='&quot;&apos;&amp;' b='-17' c='2.5'>"
+                     "text &lt;&gt; &#xA0;<e/><![CDATA[<raw>&]]><f><g>1</g><h>\nx\n</h></f>tail</r>" );
+        mixed.RootElement()->SetAttribute( "i64", (int64_t)-1234567890123LL );
+        mixed.RootElement()->SetAttribute( "u64", (uint64_t)18446744073709551615ULL );
+        mixed.RootElement()->SetAttribute( "dbl", 1.0 / 3.0 );
+        mixed.RootElement()->InsertNewChildElement( "bool" )->SetText( true );
+        mixed.SetBOM( true );
+        XMLDocument raw( false );
+        raw.Parse( "<a b='&lt;'>&amp;amp;<c>&gt;</c></a>" );
+        XMLDocument deep;
+        XMLNode* node = &deep;
+        for ( int i = 0; i < 40; ++i ) {
+            node = node->InsertEndChild( deep.NewElement( "d" ) );
+        }
+        XMLDocument empty;
+
+        const XMLDocument* docs[] = { &dream, &utf8, &mixed, &raw, &deep, &empty };
+        for ( size_t d = 0; d < sizeof( docs ) / sizeof( docs[0] ); ++d ) {
+            for ( int compact = 0; compact < 2; ++compact ) {
+                XMLPrinter printer( 0, compact != 0 );
+                docs[d]->Print( &printer );
+                XMLTest( "SerializedSize: exact", printer.CStrSize() - 1, docs[d]->SerializedSize( compact != 0 ), false );
+
+                XMLPrinter reserved( 0, compact != 0 );
+                reserved.Reserve( docs[d]->SerializedSize( compact != 0 ) );
+                const char* before = reserved.CStr();
+                docs[d]->Print( &reserved );
+                if ( printer.CStrSize() > 20 ) {
+                    XMLTest( "Reserve: no reallocation", true, before == reserved.CStr(), false );
+                }
+                XMLTest( "Reserve: same output", printer.CStr(), reserved.CStr(), false );
+            }
+        }
+
+        // Reserve() after some output leaves room for more.
+        XMLPrinter streaming;
+        streaming.OpenElement( "stream" );
+        streaming.Reserve( 1000 );
+        const char* before = streaming.CStr();
+        for ( int i = 0; i < 50; ++i ) {
+            streaming.PushText( "0123456789" );
+        }
+        XMLTest( "Reserve: streaming", true, before == streaming.CStr() );
+    }
+
+    // ----------- Hash and DeepEqual --------------
+    {
+        XMLDocument a;
+        a.LoadFile( "resources/dream.xml" );
+        XMLDocument b;
+        b.LoadFile( "resources/dream.xml" );
+        XMLTest( "Hash: same document", true, a.Hash() == b.Hash() );
+        XMLTest( "DeepEqual: same document", true, a.DeepEqual( &b ) );
+        XMLTest( "DeepEqual: self", true, a.DeepEqual( &a ) );
+        XMLTest( "DeepEqual: null", false, a.DeepEqual( 0 ) );
+
+        // An edit deep down changes the hash of the path up to the root,
+        // and undoing it restores it.
+        const uint64_t before = a.Hash();
+        XMLElement* speech = a.RootElement()->FirstChildElement( "ACT" )->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" );
+        const uint64_t speechBefore = speech->Hash();
+        const uint64_t titleBefore = a.RootElement()->FirstChildElement( "TITLE" )->Hash();
+        XMLElement* line = speech->FirstChildElement( "LINE" );
+        const char* text = line->GetText();
+        std::string saved = text;
+        line->SetText( "Changed." );
+        XMLTest( "Hash: edit changes root", true, a.Hash() != before );
+        XMLTest( "Hash: edit changes parent", true, speech->Hash() != speechBefore );
+        XMLTest( "Hash: edit keeps sibling subtree", true, a.RootElement()->FirstChildElement( "TITLE" )->Hash() == titleBefore );
+        XMLTest( "DeepEqual: after edit", false, a.DeepEqual( &b ) );
+        line->SetText( saved.c_str() );
+        XMLTest( "Hash: undo", true, a.Hash() == before );
+        XMLTest( "DeepEqual: after undo", true, a.DeepEqual( &b ) );
+
+        speech->SetAttribute( "who", "puck" );
+        XMLTest( "DeepEqual: new attribute", false, a.DeepEqual( &b ) );
+        speech->DeleteAttribute( "who" );
+        XMLTest( "DeepEqual: attribute deleted", true, a.DeepEqual( &b ) );
+        speech->SetName( "SPEECH2" );
+        XMLTest( "DeepEqual: renamed", false, a.DeepEqual( &b ) );
+        speech->SetName( "SPEECH" );
+        XMLNode* comment = speech->InsertEndChild( a.NewComment( "note" ) );
+        XMLTest( "DeepEqual: child added", false, a.DeepEqual( &b ) );
+        speech->DeleteChild( comment );
+        XMLTest( "DeepEqual: child deleted", true, a.DeepEqual( &b ) );
+        XMLNode* moved = speech->FirstChildElement( "LINE" );
+        speech->InsertEndChild( moved );
+        XMLTest( "DeepEqual: child moved", false, a.DeepEqual( &b ) );
+        speech->InsertAfterChild( speech->FirstChildElement( "SPEAKER" ), moved );
+        XMLTest( "DeepEqual: child moved back", true, a.DeepEqual( &b ) );
+
+        // Subtrees compare across documents, and clones are equal.
+        XMLDocument c;
+        c.InsertEndChild( a.RootElement()->DeepClone( &c ) );
+        XMLTest( "DeepEqual: clone", true, c.RootElement()->DeepEqual( b.RootElement() ) );
+        XMLTest( "Hash: clone", true, c.RootElement()->Hash() == b.RootElement()->Hash() );
+        XMLTest( "DeepEqual: different prolog", false, c.DeepEqual( &b ) );
+
+        // What counts: types, attribute names and order, value splits.
+        const char* pairs[][2] = {
+            { "<a x='1' y='2'/>", "<a y='2' x='1'/>" },
+            { "<a x='1'/>", "<a y='1'/>" },
+            { "<a x='1'/>", "<a x='1' y=''/>" },
+            { "<a>t</a>", "<a><!--t--></a>" },
+            { "<a><b/><c/></a>", "<a><b><c/></b></a>" },
+            { "<a><b>x</b>y</a>", "<a><b>xy</b></a>" },
+            { "<a/>", "<b/>" },
+            { "<cfg><item/></cfg>", "<cfg>htem</cfg>" },
+            { "<a><b/></a>", "<a>c</a>" },
+        };
+        for ( size_t i = 0; i < sizeof( pairs ) / sizeof( pairs[0] ); ++i ) {
+            XMLDocument x, y;
+            x.Parse( pairs[i][0] );
+            y.Parse( pairs[i][1] );
+            XMLTest( "DeepEqual: differs", false, x.DeepEqual( &y ), false );
+            XMLTest( "Hash: differs", false, x.Hash() == y.Hash(), false );
+        }
+
+        // The node type is hashed apart from the value: nodes of different
+        // types whose values differ only in the first letter hash apart.
+        {
+            int collisions = 0;
+            for ( char first = 'a'; first <= 'z'; ++first ) {
+                for ( char second = 'a'; second <= 'z'; ++second ) {
+                    const char name[] = { first, 't', 'e', 'm', 0 };
+                    const char value[] = { second, 't', 'e', 'm', 0 };
+                    XMLDocument withElement, withText, withComment;
+                    withElement.InsertEndChild( withElement.NewElement( "cfg" ) )->InsertEndChild( withElement.NewElement( name ) );
+                    withText.InsertEndChild( withText.NewElement( "cfg" ) )->InsertEndChild( withText.NewText( value ) );
+                    withComment.InsertEndChild( withComment.NewElement( "cfg" ) )->InsertEndChild( withComment.NewComment( name ) );
+                    collisions += withElement.Hash() == withText.Hash();
+                    collisions += withText.Hash() == withComment.Hash();
+                }
+            }
+            XMLTest( "Hash: types with near values", 0, collisions );
+        }
+        XMLDocument cdata, plain;
+        cdata.Parse( "<a><![CDATA[t]]></a>" );
+        plain.Parse( "<a>t</a>" );
+        XMLTest( "DeepEqual: CDATA is text, as in ShallowEqual", true, cdata.DeepEqual( &plain ) );
+
+        // Clear() and a new parse.
+        b.Parse( "<a/>" );
+        XMLDocument small;
+        small.Parse( "<a/>" );
+        XMLTest( "DeepEqual: reparsed", true, b.DeepEqual( &small ) );
+        b.Clear();
+        XMLDocument none;
+        XMLTest( "DeepEqual: cleared", true, b.DeepEqual( &none ) );
+    }
+
+    // ----------- Diff and patch --------------
+    {
+        XMLDocument a;
+        a.LoadFile( "resources/dream.xml" );
+        XMLDocument b;
+        b.LoadFile( "resources/dream.xml" );
+        XMLDocument script;
+        XMLDiff( a, b, &script );
+        XMLTest( "Diff: identical documents", true, script.RootElement()->NoChildren() );
+        XMLTest( "Patch: identical documents", XML_SUCCESS, XMLPatch( &a, script ) );
+
+        // A handful of edits deep in one document; the script is small and
+        // survives printing and parsing.
+        XMLElement* act = b.RootElement()->FirstChildElement( "ACT" );
+        XMLElement* scene = act->FirstChildElement( "SCENE" );
+        XMLElement* speech = scene->FirstChildElement( "SPEECH" );
+        speech->FirstChildElement( "LINE" )->SetText( "Changed & <escaped>." );
+        speech->SetAttribute( "who", "puck" );
+        scene->InsertEndChild( scene->FirstChildElement( "SPEECH" )->NextSiblingElement( "SPEECH" ) );
+        scene->DeleteChild( scene->LastChildElement( "STAGEDIR" ) );
+        act->InsertFirstChild( b.NewComment( "new comment" ) );
+        b.RootElement()->LastChildElement( "ACT" )->SetName( "EPILOGUE" );
+        XMLDiff( a, b, &script );
+        int ops = 0;
+        for ( const XMLElement* op = script.RootElement()->FirstChildElement(); op; op = op->NextSiblingElement() ) {
+            ++ops;
+        }
+        XMLTest( "Diff: few ops", true, ops > 0 && ops < 20 );
+        XMLPrinter printer;
+        script.Print( &printer );
+        XMLDocument parsed;
+        parsed.Parse( printer.CStr(), printer.CStrSize() - 1 );
+        XMLTest( "Diff: script parses", false, parsed.Error() );
+        XMLTest( "Patch: edits", XML_SUCCESS, XMLPatch( &a, parsed ) );
+        XMLTest( "Patch: result equals target", true, a.DeepEqual( &b ) );
+
+        // A script only applies to the document it was made from.
+        XMLTest( "Patch: wrong base", XML_ERROR_BAD_PATCH, XMLPatch( &a, parsed ) );
+        XMLTest( "Patch: wrong base unchanged", true, a.DeepEqual( &b ) );
+
+        // Small cases: reorders, attribute order, text, declarations,
+        // whitespace text, changes of node type.
+        const char* pairs[][2] = {
+            { "<a><b/><c/><d/></a>", "<a><d/><b/><c/></a>" },
+            { "<a><b/><c/><d/><e/></a>", "<a><e/><d/><c/><b/></a>" },
+            { "<a x='1' y='2'/>", "<a y='2' x='1'/>" },
+            { "<a x='1' y='2'/>", "<a x='3' z='4'/>" },
+            { "<a>t</a>", "<a><!--t--></a>" },
+            { "<a><b>x</b>y</a>", "<a><b>xy</b></a>" },
+            { "<a><b/><c/></a>", "<a><b><c/></b></a>" },
+            { "<a/>", "<?xml version='1.0'?><!DOCTYPE a><a/>" },
+            { "<?xml version='1.0'?><a/>", "<a/><?pi x?>" },
+            { "<a><b/><b/><b x='1'/></a>", "<a><b x='1'/><c/><b/></a>" },
+            { "<a><![CDATA[old]]></a>", "<a><![CDATA[new]]></a>" },
+            { "<a/>", "<b/>" },
+            { "<a>   </a>", "<a/>" },
+        };
+        for ( size_t i = 0; i < sizeof( pairs ) / sizeof( pairs[0] ); ++i ) {
+            XMLDocument x( true, COLLAPSE_WHITESPACE ), y;
+            x.Parse( pairs[i][0] );
+            y.Parse( pairs[i][1] );
+            XMLDiff( x, y, &script );
+            XMLTest( "Patch: small case", XML_SUCCESS, XMLPatch( &x, script ), false );
+            XMLTest( "Patch: small case equal", true, x.DeepEqual( &y ), false );
+        }
+        {
+            // Whitespace-only text, which a parse of the script would drop.
+            XMLDocument x, y;
+            x.Parse( "<a><b/></a>" );
+            y.Parse( "<a/>" );
+            y.RootElement()->InsertEndChild( y.NewText( "  " ) );
+            XMLDiff( x, y, &script );
+            XMLPrinter p;
+            script.Print( &p );
+            parsed.Parse( p.CStr() );
+            XMLTest( "Patch: whitespace text", XML_SUCCESS, XMLPatch( &x, parsed ) );
+            XMLTest( "Patch: whitespace text equal", true, x.DeepEqual( &y ) );
+        }
+
+        {
+            // A wide parent, shuffled, with children dropped, added and
+            // edited; the moves are worked out on every layout.
+            static const int CHILDREN = 600;
+            XMLDocument x, y;
+            XMLElement* xr = x.NewElement( "r" );
+            XMLElement* yr = y.NewElement( "r" );
+            x.InsertEndChild( xr );
+            y.InsertEndChild( yr );
+            unsigned seed = 12345;
+            for ( int i = 0; i < CHILDREN; ++i ) {
+                xr->InsertNewChildElement( "c" )->SetAttribute( "id", i );
+            }
+            for ( int i = 0; i < CHILDREN; ++i ) {
+                seed = seed * 1103515245u + 12345u;
+                const int id = static_cast<int>( ( seed >> 8 ) % ( CHILDREN + CHILDREN / 10 ) );
+                XMLElement* c = yr->InsertNewChildElement( "c" );
+                c->SetAttribute( "id", id );
+                if ( id % 7 == 0 ) {
+                    c->InsertNewChildElement( "sub" );
+                }
+            }
+            XMLDiff( x, y, &script );
+            XMLTest( "Patch: shuffled wide parent", XML_SUCCESS, XMLPatch( &x, script ) );
+            XMLTest( "Patch: shuffled wide parent equal", true, x.DeepEqual( &y ) );
+        }
+        {
+            // Random pairs of small documents, unrelated or one edit apart:
+            // only equal documents give an empty script, and every script
+            // turns the one into the other.
+            static const int PAIRS = 2000;
+            unsigned seed = 4242;
+            int failures = 0;
+            for ( int i = 0; i < PAIRS; ++i ) {
+                XMLDocument x, y;
+                RandomChildren( &x, x.InsertEndChild( x.NewElement( "cfg" ) ), &seed, 2 );
+                if ( i % 2 ) {
+                    x.DeepCopy( &y );
+                    XMLElement* root = y.RootElement();
+                    if ( root->FirstChild() && NextRandom( &seed ) % 2 ) {
+                        root->DeleteChild( root->FirstChild() );
+                    }
+                    RandomChildren( &y, root, &seed, 1 );
+                }
+                else {
+                    RandomChildren( &y, y.InsertEndChild( y.NewElement( "cfg" ) ), &seed, 2 );
+                }
+                XMLDiff( x, y, &script );
+                const bool empty = script.RootElement()->NoChildren();
+                if ( empty != x.DeepEqual( &y ) || XMLPatch( &x, script ) != XML_SUCCESS || !x.DeepEqual( &y ) ) {
+                    ++failures;
+                }
+            }
+            XMLTest( "Patch: random pairs", 0, failures );
+        }
+        {
+            // Far deeper than the stack would allow a recursive diff.
+            static const int DEPTH = 100000;
+            XMLDocument x, y;
+            XMLNode* nx = &x;
+            XMLNode* ny = &y;
+            for ( int i = 0; i < DEPTH; ++i ) {
+                nx = nx->InsertEndChild( x.NewElement( "d" ) );
+                ny = ny->InsertEndChild( y.NewElement( "d" ) );
+            }
+            nx->InsertEndChild( x.NewText( "old" ) );
+            ny->InsertEndChild( y.NewText( "new" ) );
+            XMLDiff( x, y, &script );
+            const XMLElement* op = script.RootElement()->FirstChildElement();
+            XMLTest( "Diff: deep tree", true, op && !op->NextSiblingElement() );
+            XMLTest( "Patch: deep tree", XML_SUCCESS, XMLPatch( &x, script ) );
+            XMLTest( "Patch: deep tree equal", true, x.DeepEqual( &y ) );
+        }
+
+        // Malformed scripts fail, and the ops before the error stay applied.
+        const char* bad[] = {
+            "<patch/>",
+            "<diff><delete path=''/></diff>",
+            "<diff><delete path='0/7'/></diff>",
+            "<diff><delete path='0/'/></diff>",
+            "<diff><delete path='x'/></diff>",
+            "<diff><set path='0' name='x'/></diff>",
+            "<diff><insert path='0' index='5'><b/></insert></diff>",
+            "<diff><insert path='0' index='0'/></diff>",
+            "<diff><move path='0' to='0/0' index='0'/></diff>",
+            "<diff><frobnicate path='0'/></diff>",
+        };
+        for ( size_t i = 0; i < sizeof( bad ) / sizeof( bad[0] ); ++i ) {
+            XMLDocument x;
+            x.Parse( "<a><b/></a>" );
+            XMLDocument s;
+            s.Parse( bad[i] );
+            XMLTest( "Patch: bad script", XML_ERROR_BAD_PATCH, XMLPatch( &x, s ), false );
+        }
+        XMLDocument empty;
+        XMLTest( "Patch: empty script", XML_ERROR_BAD_PATCH, XMLPatch( &a, empty ) );
+    }
+
+    // ----------- Shared strings --------------
+    {
+        CountingAllocator allocator;
+        {
+            XMLDocument original;
+            original.SetAllocator( &allocator );
+            original.LoadFile( "resources/dream.xml" );
+            // The strings of a parsed document are in its parse buffer: a
+            // copy copies them, and leaves the source as it was.
+            const char* name = original.RootElement()->Name();
+            XMLDocument first;
+            first.SetAllocator( &allocator );
+            int allocations = allocator.allocations;
+            original.DeepCopy( &first );
+            const int firstCopy = allocator.allocations - allocations;
+            XMLTest( "Shared strings: copy", true, original.DeepEqual( &first ) );
+            XMLTest( "Shared strings: source not written", true, original.RootElement()->Name() == name );
+            XMLTest( "Shared strings: parsed strings copied", true, first.RootElement()->Name() != name );
+
+            // FinalizeStrings() moves them into counted memory; from then
+            // on a copy shares them and only allocates nodes.
+            original.FinalizeStrings();
+            XMLDocument second;
+            second.SetAllocator( &allocator );
+            allocations = allocator.allocations;
+            original.DeepCopy( &second );
+            const int secondCopy = allocator.allocations - allocations;
+            XMLTest( "Shared strings: finalized copies allocate less", true, secondCopy * 10 < firstCopy );
+            XMLTest( "Shared strings: same memory", true, second.RootElement()->Name() == original.RootElement()->Name() );
+            const XMLElement* line = original.RootElement()->FirstChildElement( "ACT" )->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" )->FirstChildElement( "LINE" );
+            XMLElement* copiedLine = second.RootElement()->FirstChildElement( "ACT" )->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" )->FirstChildElement( "LINE" );
+            XMLTest( "Shared strings: text shared", true, copiedLine->GetText() == line->GetText() );
+
+            // Writing to a copy replaces its own string only.
+            const std::string text = line->GetText();
+            copiedLine->SetText( "Changed." );
+            copiedLine->SetAttribute( "edited", true );
+            XMLTest( "Shared strings: copy written", "Changed.", copiedLine->GetText() );
+            XMLTest( "Shared strings: original kept", text.c_str(), line->GetText() );
+            XMLTest( "Shared strings: other copy kept", true, original.DeepEqual( &first ) );
+            XMLTest( "Shared strings: written copy differs", false, original.DeepEqual( &second ) );
+
+            // The copies outlive the original, also with a string arena.
+            XMLDocument arena;
+            arena.SetAllocator( &allocator );
+            arena.SetStringArena( true );
+            first.DeepCopy( &arena );
+            original.Clear();
+            XMLDocument reloaded;
+            reloaded.LoadFile( "resources/dream.xml" );
+            XMLTest( "Shared strings: copy after original cleared", true, first.DeepEqual( &reloaded ) );
+            XMLTest( "Shared strings: arena copy", true, arena.DeepEqual( &reloaded ) );
+
+            // A document with another allocator copies the strings, so
+            // the copy doesn't depend on that allocator.
+            CountingAllocator* otherAllocator = new CountingAllocator;
+            XMLDocument* source = new XMLDocument;
+            source->SetAllocator( otherAllocator );
+            source->LoadFile( "resources/dream.xml" );
+            source->RootElement()->SetAttribute( "edited", "yes" );
+            XMLDocument copy;
+            copy.SetAllocator( &allocator );
+            source->DeepCopy( &copy );
+            XMLTest( "Shared strings: other allocator copies", true, copy.RootElement()->Name() != source->RootElement()->Name() );
+            delete source;
+            XMLTest( "Shared strings: other allocator returned", true, otherAllocator->liveBytes == 0 );
+            delete otherAllocator;
+            XMLTest( "Shared strings: copy outlives the other allocator", "yes", copy.RootElement()->Attribute( "edited" ) );
+            copy.RootElement()->DeleteAttribute( "edited" );
+            XMLTest( "Shared strings: other allocator copy", true, copy.DeepEqual( &reloaded ) );
+
+            // Clones within a document, and attribute order.
+            XMLDocument doc;
+            doc.Parse( "<a z='1' b='2' m='3'><b/></a>" );
+            XMLNode* clone = doc.RootElement()->DeepClone( 0 );
+            doc.RootElement()->SetAttribute( "z", 9 );
+            doc.InsertEndChild( clone );
+            XMLPrinter printer;
+            doc.Print( &printer );
+            XMLTest( "Shared strings: clone in the same document", "<a z=\"9\" b=\"2\" m=\"3\">\n    <b/>\n</a>\n\n<a z=\"1\" b=\"2\" m=\"3\">\n    <b/>\n</a>\n", printer.CStr() );
+        }
+        XMLTest( "Shared strings: all memory returned", true, allocator.liveBytes == 0 );
+        XMLTest( "Shared strings: sizes match", false, allocator.sizeMismatch );
+    }
+
+    // ----------- Iterators --------------
+    {
+        XMLDocument doc;
+        doc.Parse( "<r><a x='1' y='2'><b/>t<c><d/></c></a><e/><a/></r>" );
+        XMLElement* root = doc.RootElement();
+
+        std::string names;
+        XMLRange< XMLElementIterator<XMLElement> > children = root->ChildElements();
+        for ( XMLElementIterator<XMLElement> it = children.begin(); it != children.end(); ++it ) {
+            names += it->Name();
+        }
+        XMLTest( "Iterators: child elements", "aea", names.c_str() );
+        int count = 0;
+        XMLRange< XMLElementIterator<XMLElement> > as = root->ChildElements( "a" );
+        for ( XMLElementIterator<XMLElement> it = as.begin(); it != as.end(); it++ ) {
+            ++count;
+        }
+        XMLTest( "Iterators: named child elements", 2, count );
+        XMLTest( "Iterators: no such elements", true, root->ChildElements( "z" ).Empty() );
+
+        std::string attributes;
+        XMLRange<XMLAttributeIterator> attributeRange = root->FirstChildElement()->Attributes();
+        for ( XMLAttributeIterator it = attributeRange.begin(); it != attributeRange.end(); ++it ) {
+            attributes += it->Name();
+            attributes += (*it).Value();
+        }
+        XMLTest( "Iterators: attributes", "x1y2", attributes.c_str() );
+        XMLTest( "Iterators: no attributes", true, root->Attributes().Empty() );
+
+        // Pre- and post-order, of the whole tree and of a subtree.
+        const XMLNode* constRoot = root;
+        std::string pre;
+        XMLRange< XMLPreOrderIterator<const XMLNode> > preRange = constRoot->Descendants();
+        for ( XMLPreOrderIterator<const XMLNode> it = preRange.begin(); it != preRange.end(); ++it ) {
+            pre += it->Value();
+        }
+        XMLTest( "Iterators: pre-order", "abtcdea", pre.c_str() );
+        std::string post;
+        XMLRange< XMLPostOrderIterator<const XMLNode> > postRange = constRoot->DescendantsPostOrder();
+        for ( XMLPostOrderIterator<const XMLNode> it = postRange.begin(); it != postRange.end(); ++it ) {
+            post += it->Value();
+        }
+        XMLTest( "Iterators: post-order", "btdcaea", post.c_str() );
+        std::string subtree;
+        XMLRange< XMLPreOrderIterator<XMLNode> > subRange = root->FirstChildElement( "a" )->Descendants();
+        for ( XMLPreOrderIterator<XMLNode> it = subRange.begin(); it != subRange.end(); ++it ) {
+            subtree += it->Value();
+        }
+        XMLRange< XMLPostOrderIterator<XMLNode> > subPost = root->FirstChildElement( "a" )->DescendantsPostOrder();
+        for ( XMLPostOrderIterator<XMLNode> it = subPost.begin(); it != subPost.end(); ++it ) {
+            subtree += it->Value();
+        }
+        XMLTest( "Iterators: subtree", "btcdbtdc", subtree.c_str() );
+        XMLTest( "Iterators: leaf", true, root->FirstChildElement( "e" )->Descendants().Empty() && root->FirstChildElement( "e" )->DescendantsPostOrder().Empty() );
+
+        // The whole of dream.xml, against a FirstChild()/NextSibling() walk.
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        int walked = 0;
+        for ( const XMLNode* node = dream.FirstChild(); node; ) {
+            ++walked;
+            if ( node->FirstChild() ) {
+                node = node->FirstChild();
+                continue;
+            }
+            while ( node && !node->NextSibling() ) {
+                node = node->Parent();
+            }
+            node = node ? node->NextSibling() : 0;
+        }
+        int preCount = 0;
+        int postCount = 0;
+        XMLRange< XMLPreOrderIterator<XMLNode> > all = dream.Descendants();
+        for ( XMLPreOrderIterator<XMLNode> it = all.begin(); it != all.end(); ++it ) {
+            ++preCount;
+        }
+        XMLRange< XMLPostOrderIterator<XMLNode> > allPost = dream.DescendantsPostOrder();
+        for ( XMLPostOrderIterator<XMLNode> it = allPost.begin(); it != allPost.end(); ++it ) {
+            ++postCount;
+        }
+        XMLTest( "Iterators: dream.xml pre-order", walked, preCount );
+        XMLTest( "Iterators: dream.xml post-order", walked, postCount );
+
+#if __cplusplus >= 201103L || ( defined( _MSC_VER ) && _MSC_VER >= 1900 )
+        // Range-based for; the loops may change what they visit.
+        for ( XMLElement& a : root->ChildElements( "a" ) ) {
+            a.SetAttribute( "seen", true );
+        }
+        int seen = 0;
+        for ( const XMLElement& element : constRoot->ChildElements() ) {
+            seen += element.BoolAttribute( "seen" ) ? 1 : 0;
+        }
+        XMLTest( "Iterators: range-based for", 2, seen );
+        std::string ranged;
+        for ( const XMLAttribute& a : root->FirstChildElement()->Attributes() ) {
+            ranged += a.Name();
+        }
+        for ( XMLNode& node : root->Descendants() ) {
+            ranged += node.Value();
+        }
+        XMLTest( "Iterators: range-based for attributes and descendants", "xyseenabtcdea", ranged.c_str() );
+#endif
+    }
+
+    // ----------- Node types --------------
+    {
+        XMLDocument doc;
+        doc.Parse( "<?xml version='1.0'?><!DOCTYPE r><!--c--><r>t</r>" );
+        const XMLNode* node = doc.FirstChild();
+        XMLTest( "Node types: document", XMLNode::DOCUMENT_NODE, doc.Type() );
+        XMLTest( "Node types: declaration", XMLNode::DECLARATION_NODE, node->Type() );
+        XMLTest( "Node types: unknown", XMLNode::UNKNOWN_NODE, node->NextSibling()->Type() );
+        XMLTest( "Node types: comment", XMLNode::COMMENT_NODE, node->NextSibling()->NextSibling()->Type() );
+        XMLTest( "Node types: element", XMLNode::ELEMENT_NODE, doc.RootElement()->Type() );
+        XMLTest( "Node types: text", XMLNode::TEXT_NODE, doc.RootElement()->FirstChild()->Type() );
+        XMLTest( "Node types: casts", true, node->ToDeclaration() == node && !node->ToElement() && !node->ToDocument()
+                 && doc.ToDocument() == &doc && !doc.ToElement() && doc.RootElement()->FirstChild()->ToText() != 0 );
+        XMLText* cdata = doc.NewText( "x" );
+        cdata->SetCData( true );
+        XMLTest( "Node types: CDATA is text", XMLNode::TEXT_NODE, cdata->Type() );
+    }
+
+    // ----------- Static visitor --------------
+    {
+        static const char* xml =
+            "<?xml version='1.0'?><!DOCTYPE x>"
+            "<a><b>one<c/>two</b><skip><d/></skip><e>stop<f/></e>"
+            "<g><!--stop--><h/></g><i/></a>"
+            "<!--after-->";
+        XMLDocument doc;
+        doc.Parse( xml );
+        XMLTest( "Static visitor: parse", false, doc.Error() );
+
+        RecordingVisitor dynamic;
+        const bool accepted = doc.Accept( &dynamic );
+        StaticRecordingVisitor fixed;
+        const bool visited = Visit( doc, fixed );
+        XMLTest( "Static visitor: same calls as Accept", dynamic.record.calls.c_str(), fixed.record.calls.c_str() );
+        XMLTest( "Static visitor: same result as Accept", accepted, visited );
+        XMLTest( "Static visitor: calls",
+                 "+#doc ?xml version='1.0' !DOCTYPE x +a +b t:one +c -c t:two -b +skip -skip +e t:stop -e "
+                 "+g c:stop -g +i -i -a c:after -#doc ",
+                 fixed.record.calls.c_str() );
+
+        // From a subtree, and from single nodes.
+        const XMLElement* e = doc.RootElement()->FirstChildElement( "e" );
+        RecordingVisitor dynamicE;
+        StaticRecordingVisitor fixedE;
+        XMLTest( "Static visitor: subtree result", e->Accept( &dynamicE ), Visit( *e, fixedE ) );
+        XMLTest( "Static visitor: subtree calls", "+e t:stop -e ", fixedE.record.calls.c_str() );
+        XMLTest( "Static visitor: subtree same calls", dynamicE.record.calls.c_str(), fixedE.record.calls.c_str() );
+
+        const XMLNode* stop = e->FirstChild();
+        RecordingVisitor dynamicLeaf;
+        StaticRecordingVisitor fixedLeaf;
+        XMLTest( "Static visitor: leaf result", false, Visit( *stop, fixedLeaf ) );
+        XMLTest( "Static visitor: leaf same result", stop->Accept( &dynamicLeaf ), false );
+        XMLTest( "Static visitor: leaf calls", "t:stop ", fixedLeaf.record.calls.c_str() );
+
+        // Handlers that aren't defined fall back to the defaults.
+        StaticElementCounter counter;
+        XMLTest( "Static visitor: defaults continue", true, Visit( doc, counter ) );
+        XMLTest( "Static visitor: count", 10, counter.elements );
+
+        // An empty document is entered and exited.
+        XMLDocument empty;
+        StaticElementCounter none;
+        XMLTest( "Static visitor: empty document", true, Visit( empty, none ) );
+        XMLTest( "Static visitor: empty count", 0, none.elements );
+    }
+
+    // ----------- Deep trees --------------
+    {
+        // Far deeper than the stack would allow a recursive walk.
+        static const int DEPTH = 100000;
+        XMLDocument doc;
+        XMLNode* node = &doc;
+        for ( int i = 0; i < DEPTH; ++i ) {
+            node = node->InsertEndChild( doc.NewElement( "d" ) );
+        }
+        node->InsertEndChild( doc.NewText( "bottom" ) );
+        doc.RootElement()->InsertEndChild( doc.NewComment( "last" ) );
+
+        ElementCounter counter;
+        XMLTest( "Deep trees: Accept", true, doc.Accept( &counter ) );
+        XMLTest( "Deep trees: Accept count", DEPTH, counter.elements );
+
+        XMLDocument copy;
+        doc.DeepCopy( &copy );
+        XMLTest( "Deep trees: DeepCopy", true, copy.DeepEqual( &doc ) );
+        const XMLNode* bottom = copy.RootElement();
+        int depth = 0;
+        while ( bottom->FirstChild() ) {
+            bottom = bottom->FirstChild();
+            ++depth;
+        }
+        XMLTest( "Deep trees: copy depth", DEPTH, depth );
+        XMLTest( "Deep trees: copy bottom", "bottom", bottom->Value() );
+        XMLTest( "Deep trees: copy last", "last", copy.RootElement()->LastChild()->Value() );
+
+        XMLNode* clone = doc.RootElement()->FirstChild()->DeepClone( &copy );
+        XMLTest( "Deep trees: DeepClone", true, clone->DeepEqual( doc.RootElement()->FirstChild() ) );
+        copy.DeleteNode( clone );
+
+        copy.RootElement()->DeleteChildren();
+        XMLTest( "Deep trees: DeleteChildren", true, copy.RootElement()->NoChildren() );
+        doc.DeleteChildren();
+        XMLTest( "Deep trees: DeleteChildren of the document", true, doc.NoChildren() );
+    }
+
+    // ----------- Pool policy --------------
+    {
+        XMLPoolPolicy policy;
+        policy.blockSize = 1024;
+        policy.maxBlockSize = 1024 * 1024;
+        policy.alignment = 64;
+        policy.hugePages = true;
+
+        XMLDocument doc;
+        doc.SetPoolPolicy( policy );
+        XMLTest( "Pool policy: kept", true, doc.PoolPolicy().alignment == 64 && doc.PoolPolicy().blockSize == 1024 );
+        doc.LoadFile( "resources/dream.xml" );
+        XMLTest( "Pool policy: parse", false, doc.Error() );
+        XMLTest( "Pool policy: aligned block", true, ( reinterpret_cast<uintptr_t>( doc.FirstChild() ) & 63 ) == 0 );
+
+        XMLDocument reference;
+        reference.LoadFile( "resources/dream.xml" );
+        XMLPrinter p0, p1;
+        doc.Print( &p0 );
+        reference.Print( &p1 );
+        XMLTest( "Pool policy: same document", p1.CStr(), p0.CStr() );
+
+        // Degenerate sizes still hold at least one item per block.
+        policy.blockSize = 1;
+        policy.maxBlockSize = 0;
+        policy.alignment = 3;
+        XMLDocument tiny;
+        tiny.SetPoolPolicy( policy );
+        tiny.Parse( "<a x='1'><b/><c>text</c><!--d--></a>" );
+        XMLTest( "Pool policy: tiny blocks", false, tiny.Error() );
+        XMLTest( "Pool policy: tiny blocks content", "text", tiny.RootElement()->FirstChildElement( "c" )->GetText() );
+    }
+
+    // ----------- Printer output paths --------------
+    {
+        // Deep enough that indentation takes more than one write, with
+        // entities in text and attributes, and every numeric overload.
+        XMLPrinter plain;
+        CapturingPrinter hooked;
+        XMLPrinter* printers[] = { &plain, &hooked };
+        for ( int n = 0; n < 2; ++n ) {
+            XMLPrinter* printer = printers[n];
+            for ( int i = 0; i < 20; ++i ) {
+                printer->OpenElement( "deep" );
+            }
+            printer->PushAttribute( "quote", "\"it's\" <a> & <b>" );
+            printer->PushAttribute( "int", INT_MIN );
+            printer->PushAttribute( "unsigned", UINT_MAX );
+            printer->PushAttribute( "int64", INT64_MIN );
+            printer->PushAttribute( "uint64", UINT64_MAX );
+            printer->OpenElement( "text" );
+            printer->PushText( "a < b && c > \"d\"" );
+            printer->CloseElement();
+            printer->PushText( -42 );
+            for ( int i = 0; i < 20; ++i ) {
+                printer->CloseElement();
+            }
+            printer->PushComment( "done" );
+        }
+        XMLTest( "Printer: hooks see everything", plain.CStr(), hooked.text );
+        XMLTest( "Printer: hooks bypass the buffer", true, hooked.CStrSize() == 1 );
+        XMLTest( "Printer: numbers", true,
+                 strstr( plain.CStr(), "int=\"-2147483648\" unsigned=\"4294967295\" "
+                         "int64=\"-9223372036854775808\" uint64=\"18446744073709551615\"" ) != 0 );
+        XMLTest( "Printer: entities", true,
+                 strstr( plain.CStr(), "quote=\"&quot;it&apos;s&quot; &lt;a&gt; &amp; &lt;b&gt;\"" ) != 0 &&
+                 strstr( plain.CStr(), ">a &lt; b &amp;&amp; c &gt; \"d\"</text>" ) != 0 );
+        XMLTest( "Printer: deep indentation", true, strstr( plain.CStr(), "\n" "                                                                                <text>" ) != 0 );
+
+        CapturingPrinter tabbed( true );
+        tabbed.OpenElement( "a" );
+        tabbed.OpenElement( "b" );
+        tabbed.CloseElement();
+        tabbed.CloseElement();
+        XMLTest( "Printer: PrintSpace override", "<a>\n\t<b/>\n</a>\n", tabbed.text );
+
+        char buf[8];
+        XMLUtil::ToStr( INT64_MIN, buf, sizeof( buf ) );
+        XMLTest( "ToStr: truncates like snprintf", "-922337", buf );
+        XMLUtil::ToStr( 0, buf, sizeof( buf ) );
+        XMLTest( "ToStr: zero", "0", buf );
+    }
+
+    // ----------- Escape scanning --------------
+    {
+        // Every escapable character at every position and alignment, in
+        // text and attribute values, against a byte-at-a-time reference.
+        static const char special[] = "&<>\"'";
+        bool ok = true;
+        char buffer[64];
+        for ( int offset = 0; offset < 16; ++offset ) {
+            char* input = buffer + offset;
+            for ( int len = 1; len < 40; ++len ) {
+                for ( int pos = 0; pos < len; ++pos ) {
+                    for ( int c = 0; c < 5; ++c ) {
+                        for ( int i = 0; i < len; ++i ) {
+                            input[i] = char( 'a' + i % 26 );
+                        }
+                        input[pos] = special[c];
+                        input[len] = 0;
+
+                        std::string text;
+                        std::string attribute;
+                        for ( int i = 0; i < len; ++i ) {
+                            switch ( input[i] ) {
+                                case '&':	text += "&amp;";	attribute += "&amp;";	break;
+                                case '<':	text += "&lt;";		attribute += "&lt;";	break;
+                                case '>':	text += "&gt;";		attribute += "&gt;";	break;
+                                case '"':	text += '"';		attribute += "&quot;";	break;
+                                case '\'':	text += '\'';		attribute += "&apos;";	break;
+                                default:	text += input[i];	attribute += input[i];	break;
+                            }
+                        }
+
+                        XMLPrinter printer( 0, true );
+                        printer.OpenElement( "e" );
+                        printer.PushAttribute( "a", input );
+                        printer.PushText( input );
+                        printer.CloseElement( true );
+                        ok = ok && "<e a=\"" + attribute + "\">" + text + "</e>" == printer.CStr();
+                    }
+                }
+            }
+        }
+        XMLTest( "Escape scanning", true, ok );
+    }
+
+    // ----------- Output sinks --------------
+    {
+        XMLDocument dream;
+        dream.LoadFile( "resources/dream.xml" );
+        XMLPrinter reference;
+        dream.Print( &reference );
+
+        std::string str;
+        {
+            XMLStringSink< std::string > sink( &str );
+            XMLPrinter printer( sink );
+            dream.Print( &printer );
+            XMLTest( "Sink: flush", true, printer.Flush() );
+        }
+        XMLTest( "Sink: string", reference.CStr(), str.c_str() );
+
+        // A small buffer forces many flushes; each is one large chunk.
+        SinkRecord record;
+        {
+            XMLCallbackSink sink( RecordChunk, &record );
+            XMLPrinter printer( sink, false, 0, 4096 );
+            dream.Print( &printer );
+        }
+        XMLTest( "Sink: callback", reference.CStr(), record.text.c_str() );
+        XMLTest( "Sink: chunked", true, record.calls > 10 && record.calls < 100 );
+
+        // A fragment bigger than the buffer is passed through, not copied.
+        SinkRecord big;
+        {
+            std::string text( 10000, 'x' );
+            XMLCallbackSink sink( RecordChunk, &big );
+            XMLPrinter printer( sink, true, 0, 1024 );
+            printer.OpenElement( "a" );
+            printer.PushText( text.c_str() );
+            printer.CloseElement();
+            XMLTest( "Sink: large fragment", true, big.largest == text.size() );
+            XMLTest( "Sink: only the tail buffered", "</a>\n", printer.CStr() );
+            printer.Flush();
+            XMLTest( "Sink: large fragment content", true, big.text == "<a>" + text + "</a>\n" );
+        }
+
+        SinkRecord failing;
+        failing.fail = true;
+        {
+            XMLCallbackSink sink( RecordChunk, &failing );
+            XMLPrinter printer( sink );
+            printer.OpenElement( "a" );
+            printer.CloseElement();
+            XMLTest( "Sink: failure reported", false, printer.Flush() );
+        }
+
+        std::string destructed;
+        {
+            XMLStringSink< std::string > sink( &destructed );
+            XMLPrinter printer( sink, true );
+            printer.OpenElement( "a" );
+            printer.PushAttribute( "b", 1 );
+            printer.CloseElement();
+        }
+        XMLTest( "Sink: destructor flushes", "<a b=\"1\"/>\n", destructed.c_str() );
+
+#ifdef TINYXML2_HAS_POSIX_IO
+        const int fd = open( "resources/out/sink.xml", O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        XMLTest( "Sink: open fd", true, fd >= 0 );
+        {
+            XMLFdSink sink( fd );
+            XMLPrinter printer( sink, false, 0, 8192 );
+            dream.Print( &printer );
+            XMLTest( "Sink: fd flush", true, printer.Flush() );
+        }
+        close( fd );
+        XMLDocument readBack;
+        readBack.LoadFile( "resources/out/sink.xml" );
+        XMLPrinter readBackPrinter;
+        readBack.Print( &readBackPrinter );
+        XMLTest( "Sink: fd", reference.CStr(), readBackPrinter.CStr() );
+#endif
+    }
+
     // ----------- Performance tracking --------------
 	{
 #if defined( _MSC_VER )
@@ -2544,6 +4269,477 @@ int main( int argc, const char ** argv )
 		printf("\nParsing dream.xml (%s): %.3f milli-seconds\n", note, duration);
 	}
 
+	{
+		// Serialization throughput, to memory and to a file.
+		XMLDocument dream;
+		dream.LoadFile( "resources/dream.xml" );
+		static const int COUNT = 20;
+		size_t bytes = 0;
+		clock_t cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter printer;
+			dream.Print( &printer );
+			bytes += printer.CStrSize() - 1;
+		}
+		clock_t cend = clock();
+		const double memoryMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / COUNT;
+
+		FILE* printFile = fopen( "resources/out/dreamprint.xml", "w" );
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter printer( printFile );
+			dream.Print( &printer );
+		}
+		cend = clock();
+		fclose( printFile );
+		const double fileMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / COUNT;
+		const double megabytes = (double)bytes / COUNT / ( 1024.0 * 1024.0 );
+		printf( "Printing dream.xml: memory %.3f milli-seconds (%.0f MB/s), file %.3f milli-seconds\n",
+				memoryMs, memoryMs > 0 ? megabytes * 1000.0 / memoryMs : 0.0, fileMs );
+
+		// Sized up front: one allocation, no copying as the buffer grows.
+		size_t sized = 0;
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			sized = dream.SerializedSize();
+		}
+		cend = clock();
+		const double sizeMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / COUNT;
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter printer;
+			printer.Reserve( dream.SerializedSize() );
+			dream.Print( &printer );
+		}
+		cend = clock();
+		const double reservedMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / COUNT;
+		XMLTest( "SerializedSize: dream.xml", true, sized == bytes / COUNT );
+		printf( "Printing dream.xml: SerializedSize %.3f milli-seconds, reserved memory (sizing included) %.3f milli-seconds\n",
+				sizeMs, reservedMs );
+
+		// Hashing: the first Hash() visits every node, after an edit only
+		// the path to the root is hashed again.
+		XMLDocument other;
+		other.LoadFile( "resources/dream.xml" );
+		cstart = clock();
+		const uint64_t hash = dream.Hash();
+		cend = clock();
+		const double firstMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+		other.Hash();
+		XMLElement* line = dream.RootElement()->LastChildElement( "ACT" )->LastChildElement( "SCENE" )->LastChildElement( "SPEECH" )->LastChildElement( "LINE" );
+		static const int EDITS = 1000;
+		bool equal = false;
+		cstart = clock();
+		for ( int i = 0; i < EDITS; ++i ) {
+			line->SetAttribute( "edit", i );
+			equal = dream.DeepEqual( &other ) || equal;
+		}
+		cend = clock();
+		const double editMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / EDITS;
+		XMLTest( "Hash: edits differ", false, equal || dream.Hash() == hash );
+		line->DeleteAttribute( "edit" );
+		cstart = clock();
+		equal = dream.DeepEqual( &other );
+		cend = clock();
+		const double equalMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+		XMLTest( "Hash: equal again", true, equal );
+		printf( "Hashing dream.xml: first Hash %.3f milli-seconds, edit + DeepEqual %.4f milli-seconds, DeepEqual of equal trees %.3f milli-seconds\n",
+				firstMs, editMs, equalMs );
+
+		// Counting the elements of dream.xml: a visitor, the descendant
+		// iterator, and the static visitor.
+		{
+			static const int WALKS = 100;
+			ElementCounter counter;
+			cstart = clock();
+			for ( int i = 0; i < WALKS; ++i ) {
+				dream.Accept( &counter );
+			}
+			cend = clock();
+			const double visitorMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / WALKS;
+			int elements = 0;
+			cstart = clock();
+			for ( int i = 0; i < WALKS; ++i ) {
+				XMLRange< XMLPreOrderIterator<const XMLNode> > nodes = static_cast<const XMLDocument&>( dream ).Descendants();
+				for ( XMLPreOrderIterator<const XMLNode> it = nodes.begin(); it != nodes.end(); ++it ) {
+					elements += it->ToElement() ? 1 : 0;
+				}
+			}
+			cend = clock();
+			const double iteratorMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / WALKS;
+			XMLTest( "Iterators: same count as the visitor", counter.elements, elements );
+			StaticElementCounter staticCounter;
+			cstart = clock();
+			for ( int i = 0; i < WALKS; ++i ) {
+				Visit( dream, staticCounter );
+			}
+			cend = clock();
+			const double staticMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / WALKS;
+			XMLTest( "Static visitor: same count as the visitor", counter.elements, staticCounter.elements );
+			printf( "Counting dream.xml elements: Accept %.4f milli-seconds, Descendants() %.4f milli-seconds, Visit() %.4f milli-seconds\n",
+					visitorMs, iteratorMs, staticMs );
+		}
+
+		// A 100000 deep tree: the whole tree operations walk it without
+		// recursing.
+		{
+			static const int DEPTH = 100000;
+			XMLDocument deep;
+			XMLNode* node = &deep;
+			for ( int i = 0; i < DEPTH; ++i ) {
+				node = node->InsertEndChild( deep.NewElement( "d" ) );
+			}
+			ElementCounter counter;
+			cstart = clock();
+			deep.Accept( &counter );
+			cend = clock();
+			const double acceptMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			XMLDocument copy;
+			cstart = clock();
+			deep.DeepCopy( &copy );
+			cend = clock();
+			const double cloneMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			cstart = clock();
+			copy.DeleteChildren();
+			cend = clock();
+			const double deleteMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			XMLTest( "Deep trees: timed walks", true, counter.elements == DEPTH && copy.NoChildren() );
+			printf( "%d deep tree: Accept %.3f milli-seconds, DeepCopy %.3f milli-seconds, DeleteChildren %.3f milli-seconds\n",
+					DEPTH, acceptMs, cloneMs, deleteMs );
+		}
+
+		// Forking a template: a copy of the parsed document copies its
+		// strings; once FinalizeStrings() moved them into counted memory,
+		// copies only count references.
+		{
+			XMLDocument source;
+			source.LoadFile( "resources/dream.xml" );
+			XMLDocument fork;
+			static const int FORKS = 20;
+			cstart = clock();
+			for ( int i = 0; i < FORKS; ++i ) {
+				source.DeepCopy( &fork );
+			}
+			cend = clock();
+			const double parsedForkMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / FORKS;
+			cstart = clock();
+			source.FinalizeStrings();
+			cend = clock();
+			const double finalizeMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			cstart = clock();
+			for ( int i = 0; i < FORKS; ++i ) {
+				source.DeepCopy( &fork );
+			}
+			cend = clock();
+			const double forkMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / FORKS;
+			XMLTest( "Shared strings: fork", true, fork.DeepEqual( &source ) );
+			printf( "Forking dream.xml: DeepCopy of the parsed document %.3f milli-seconds, FinalizeStrings %.3f milli-seconds, then DeepCopy %.3f milli-seconds\n",
+					parsedForkMs, finalizeMs, forkMs );
+		}
+
+		// Diff of two large documents that differ in a few places; the
+		// equal subtrees are skipped by hash.
+		{
+			XMLDocument big;
+			for ( int i = 0; i < 20; ++i ) {
+				big.InsertEndChild( dream.RootElement()->DeepClone( &big ) );
+			}
+			XMLDocument edited;
+			big.DeepCopy( &edited );
+			XMLElement* last = edited.LastChildElement()->LastChildElement( "ACT" );
+			last->SetAttribute( "edited", "yes" );
+			last->InsertEndChild( edited.NewComment( "added" ) );
+			edited.FirstChildElement()->DeleteChild( edited.FirstChildElement()->FirstChildElement( "TITLE" ) );
+			cstart = clock();
+			big.Hash();
+			edited.Hash();
+			cend = clock();
+			const double hashMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			XMLDocument script;
+			cstart = clock();
+			XMLDiff( big, edited, &script );
+			cend = clock();
+			const double diffMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			int ops = 0;
+			for ( const XMLElement* op = script.RootElement()->FirstChildElement(); op; op = op->NextSiblingElement() ) {
+				++ops;
+			}
+			cstart = clock();
+			const XMLError patched = XMLPatch( &big, script );
+			cend = clock();
+			const double patchMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC;
+			XMLTest( "Patch: large document", XML_SUCCESS, patched );
+			printf( "Diff of 20 x dream.xml: hashing both %.3f milli-seconds, diff %.3f milli-seconds (%d ops), patch %.3f milli-seconds\n",
+					hashMs, diffMs, ops, patchMs );
+		}
+
+		// Diff of a wide parent whose children are reversed: every child
+		// but one moves.
+		{
+			static const int CHILDREN = 20000;
+			XMLDocument forward, reversed;
+			XMLElement* fr = forward.NewElement( "r" );
+			XMLElement* rr = reversed.NewElement( "r" );
+			forward.InsertEndChild( fr );
+			reversed.InsertEndChild( rr );
+			for ( int i = 0; i < CHILDREN; ++i ) {
+				fr->InsertNewChildElement( "c" )->SetAttribute( "id", i );
+				rr->InsertNewChildElement( "c" )->SetAttribute( "id", CHILDREN - 1 - i );
+			}
+			forward.Hash();
+			reversed.Hash();
+			XMLDocument script;
+			cstart = clock();
+			XMLDiff( forward, reversed, &script );
+			cend = clock();
+			int moves = 0;
+			for ( const XMLElement* op = script.RootElement()->FirstChildElement( "move" ); op; op = op->NextSiblingElement( "move" ) ) {
+				++moves;
+			}
+			XMLTest( "Diff: reversed children", CHILDREN - 1, moves );
+			printf( "Diff of %d reversed children: %.3f milli-seconds\n", CHILDREN,
+					1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC );
+		}
+
+		// Long text runs, where escape scanning dominates.
+		std::string paragraph;
+		for ( int i = 0; i < 40; ++i ) {
+			paragraph += "The quick brown fox jumps over the lazy dog, again; ";
+		}
+		paragraph += "Q&A <done>";
+		XMLDocument textHeavy;
+		XMLElement* root = textHeavy.NewElement( "root" );
+		textHeavy.InsertEndChild( root );
+		for ( int i = 0; i < 2000; ++i ) {
+			XMLElement* p = root->InsertNewChildElement( "p" );
+			p->SetAttribute( "title", "a \"quoted\" title, long enough to be worth scanning" );
+			p->SetText( paragraph.c_str() );
+		}
+		bytes = 0;
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter printer;
+			textHeavy.Print( &printer );
+			bytes += printer.CStrSize() - 1;
+		}
+		cend = clock();
+		const double textMs = 1000.0 * (double)( cend - cstart ) / (double)CLOCKS_PER_SEC / COUNT;
+		printf( "Printing text-heavy document: %.3f milli-seconds (%.0f MB/s)\n",
+				textMs, textMs > 0 ? (double)bytes / COUNT / ( 1024.0 * 1024.0 ) * 1000.0 / textMs : 0.0 );
+	}
+
+#ifdef TINYXML2_HAS_THREADS
+	{
+		// A large document: many copies of dream.xml under one root.
+		XMLDocument dream;
+		dream.LoadFile( "resources/dream.xml" );
+		XMLDocument large;
+		XMLElement* root = large.NewElement( "library" );
+		large.InsertEndChild( root );
+		for ( int i = 0; i < 40; ++i ) {
+			root->InsertEndChild( dream.RootElement()->DeepClone( &large ) );
+		}
+
+		// Wall clock: clock() would add up the time of all the threads.
+		std::string out;
+		XMLStringSink< std::string > sink( &out );
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		{
+			XMLPrinter sequential( sink );
+			large.Print( &sequential );
+		}
+		const double sequentialMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		const size_t bytes = out.size();
+		const std::string expected = out;
+
+		out.clear();
+		XMLParallelPrinter parallel;
+		start = std::chrono::steady_clock::now();
+		parallel.Print( large, sink );
+		const double parallelMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		XMLTest( "Parallel print: large", true, out == expected );
+		printf( "Printing %.1f MB: sequential %.3f milli-seconds, parallel (%d threads, %d runs) %.3f milli-seconds\n",
+				(double)bytes / ( 1024.0 * 1024.0 ), sequentialMs, (int)std::thread::hardware_concurrency(),
+				parallel.Chunks(), parallelMs );
+
+		// Saving: how long the caller is held up.
+		start = std::chrono::steady_clock::now();
+		large.SaveFile( "resources/out/async.xml" );
+		const double saveMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		start = std::chrono::steady_clock::now();
+		XMLAsyncSave save = large.SaveFileAsync( "resources/out/async.xml" );
+		const double returnMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		XMLTest( "Async save: large", XML_SUCCESS, save.Wait() );
+		const double asyncMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		printf( "Saving %.1f MB: SaveFile %.3f milli-seconds, SaveFileAsync returns in %.3f (done in %.3f) milli-seconds\n",
+				(double)bytes / ( 1024.0 * 1024.0 ), saveMs, returnMs, asyncMs );
+#if defined( __linux__ )
+		// The slowest disk there is: a pipe nobody reads until the call has
+		// returned, so the writer cannot even open it. SaveFileAsync() still
+		// returns once the document is printed.
+		const char* fifo = "resources/out/async.fifo";
+		remove( fifo );
+		if ( mkfifo( fifo, 0600 ) == 0 ) {
+			start = std::chrono::steady_clock::now();
+			XMLAsyncSave blocked = large.SaveFileAsync( fifo );
+			const double blockedReturnMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+			XMLTest( "Async save: returns before the write", false, blocked.Done() );
+			std::string written;
+			FILE* reader = fopen( fifo, "rb" );
+			if ( reader ) {
+				char chunk[4096];
+				size_t n = 0;
+				while ( ( n = fread( chunk, 1, sizeof( chunk ), reader ) ) > 0 ) {
+					written.append( chunk, n );
+				}
+				fclose( reader );
+			}
+			XMLTest( "Async save: through a pipe", XML_SUCCESS, blocked.Wait() );
+			const double blockedMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+			XMLTest( "Async save: pipe content", true, written == expected );
+			printf( "Saving %.1f MB through a pipe read afterwards: SaveFileAsync returns in %.3f (done in %.3f) milli-seconds\n",
+					(double)bytes / ( 1024.0 * 1024.0 ), blockedReturnMs, blockedMs );
+			remove( fifo );
+		}
+#endif
+
+		// Persistent versions: publishing after a small edit, and pinning.
+		XMLPersistentDocument config;
+		config.Document()->LoadFile( "resources/dream.xml" );
+		start = std::chrono::steady_clock::now();
+		config.Publish();
+		const double firstPublishMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		XMLElement* edited = config.Document()->RootElement()->LastChildElement( "ACT" );
+		static const int PUBLISHES = 20;
+		start = std::chrono::steady_clock::now();
+		for ( int i = 0; i < PUBLISHES; ++i ) {
+			edited->SetAttribute( "edit", i );
+			config.Publish();
+		}
+		const double publishMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count() / PUBLISHES;
+		static const int PINS = 1000000;
+		uint64_t seen = 0;
+		start = std::chrono::steady_clock::now();
+		for ( int i = 0; i < PINS; ++i ) {
+			seen += config.Pin().Number();
+		}
+		const double pinNs = 1000000.0 * std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count() / PINS;
+		XMLTest( "Persistent: pins", true, seen == (uint64_t)PINS * ( PUBLISHES + 1 ) );
+		printf( "Persistent dream.xml: first Publish %.3f milli-seconds, Publish after an edit %.3f milli-seconds, Pin %.1f nano-seconds\n",
+				firstPublishMs, publishMs, pinNs );
+
+		// One edit to a large document: publishing patches a spare version
+		// along the edited path, far below the cost of a copy.
+		XMLPersistentDocument big;
+		for ( int i = 0; i < 20; ++i ) {
+			big.Document()->InsertEndChild( config.Document()->RootElement()->DeepClone( big.Document() ) );
+		}
+		big.Publish();
+		big.Publish();
+		XMLElement* bigEdited = big.Document()->LastChildElement()->LastChildElement( "ACT" )->FirstChildElement( "SCENE" );
+		start = std::chrono::steady_clock::now();
+		for ( int i = 0; i < PUBLISHES; ++i ) {
+			bigEdited->SetAttribute( "edit", i );
+			big.Publish();
+		}
+		const double bigPublishMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count() / PUBLISHES;
+		XMLDocument bigCopy;
+		start = std::chrono::steady_clock::now();
+		big.Document()->DeepCopy( &bigCopy );
+		const double bigCopyMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+		XMLTest( "Persistent: large publish equal to writer", true, big.Pin()->DeepEqual( big.Document() ) );
+		XMLTest( "Persistent: large publish well below a copy", true, bigPublishMs * 10 < bigCopyMs );
+		printf( "Persistent 20 x dream.xml: Publish after an edit %.3f milli-seconds, DeepCopy %.3f milli-seconds\n",
+				bigPublishMs, bigCopyMs );
+	}
+#endif
+
+	{
+		// Pool block policies, on dream.xml and on a generated document
+		// large enough to need thousands of 4k blocks.
+		XMLDocument dream;
+		dream.LoadFile( "resources/dream.xml" );
+		XMLPrinter dreamPrinter;
+		dream.Print( &dreamPrinter );
+
+		static const int HUGE_ITEMS = 50000;
+		XMLPrinter hugePrinter;
+		hugePrinter.OpenElement( "root" );
+		for ( int i = 0; i < HUGE_ITEMS; ++i ) {
+			hugePrinter.OpenElement( "item" );
+			hugePrinter.PushAttribute( "id", i );
+			hugePrinter.PushAttribute( "name", "value" );
+			hugePrinter.PushText( "some text content" );
+			hugePrinter.PushComment( "comment" );
+			hugePrinter.CloseElement();
+		}
+		hugePrinter.CloseElement();
+
+		struct PolicyCase {
+			const char* name;
+			size_t blockSize;
+			size_t maxBlockSize;
+			size_t alignment;
+			bool hugePages;
+		};
+		static const PolicyCase cases[] = {
+			{ "4k fixed (default)", 4 * 1024, 4 * 1024, 0, false },
+			{ "64k fixed", 64 * 1024, 64 * 1024, 0, false },
+			{ "4k doubling to 2MB", 4 * 1024, 2 * 1024 * 1024, 0, false },
+			{ "4k doubling, 64b aligned", 4 * 1024, 2 * 1024 * 1024, 64, false },
+			{ "4k doubling, huge pages", 4 * 1024, 2 * 1024 * 1024, 0, true }
+		};
+		static const int COUNTS[2] = { 10, 2 };
+		bool failed = false;
+		printf( "\nPool policy          dream.xml      %dk generated (milli-seconds)\n", int( hugePrinter.CStrSize() / 1024 ) );
+		for ( size_t c = 0; c < sizeof( cases ) / sizeof( cases[0] ); ++c ) {
+			XMLPoolPolicy policy;
+			policy.blockSize = cases[c].blockSize;
+			policy.maxBlockSize = cases[c].maxBlockSize;
+			policy.alignment = cases[c].alignment;
+			policy.hugePages = cases[c].hugePages;
+
+			double durations[2];
+			const char* inputs[2] = { dreamPrinter.CStr(), hugePrinter.CStr() };
+			for ( int input = 0; input < 2; ++input ) {
+				const clock_t cstart = clock();
+				for ( int i = 0; i < COUNTS[input]; ++i ) {
+					XMLDocument doc;
+					doc.SetPoolPolicy( policy );
+					doc.Parse( inputs[input] );
+					failed = failed || doc.Error();
+				}
+				durations[input] = 1000.0 * (double)( clock() - cstart ) / ( (double)CLOCKS_PER_SEC * COUNTS[input] );
+			}
+			printf( "%-28s %8.3f %12.3f\n", cases[c].name, durations[0], durations[1] );
+		}
+		XMLTest( "Parse with pool policies", false, failed );
+	}
+
+	{
+		// Teardown: a parsed document is released wholesale, one that owns
+		// heap strings (here a single SetValue) node by node.
+		static const int COUNT = 10;
+		double durations[2] = { 0, 0 };
+		bool failed = false;
+		for ( int ownsStrings = 0; ownsStrings < 2; ++ownsStrings ) {
+			for ( int i = 0; i < COUNT; ++i ) {
+				XMLDocument doc;
+				doc.LoadFile( "resources/dream.xml" );
+				failed = failed || doc.Error();
+				if ( ownsStrings ) {
+					doc.RootElement()->SetValue( "PLAY" );
+				}
+				const clock_t cstart = clock();
+				doc.Clear();
+				durations[ownsStrings] += 1000.0 * (double)( clock() - cstart ) / ( (double)CLOCKS_PER_SEC * COUNT );
+				failed = failed || doc.FirstChild() != 0;
+			}
+		}
+		XMLTest( "Delete dream.xml", false, failed );
+		printf( "Delete time dream.xml: %.3f milli-seconds wholesale, %.3f node by node\n", durations[0], durations[1] );
+	}
+
 #if defined( _MSC_VER ) &&  defined( TINYXML2_DEBUG )
 	{
 		_CrtMemCheckpoint( &endMemState );